@@ -0,0 +1,72 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "thread.h"
+#include "title.h"
+
+// Can be overridden from the Makefile with -DBATCH_MEM_CAP=<bytes>
+#ifndef BATCH_MEM_CAP
+	#define BATCH_MEM_CAP  (0x800000) // Total RAM used for staged CIAs
+#endif
+#define BATCH_MAX_CIA_SIZE  (0x100000) // Only CIAs up to this size are staged
+
+
+
+struct StagedCia
+{
+	std::vector<u8> data;
+	AM_TitleEntry info;
+	u64 readTicks;
+};
+
+
+// Most of an update are tiny system data CIAs. For those opening the file,
+// AM_GetCiaFileInfo and the AM setup cost more than the data itself.
+// The scan reads them into RAM in one sweep over the update dir instead,
+// takes the title info from the TMD in memory and installs them from there.
+// Only plain CIAs are staged. Compressed ones take the normal path.
+class CiaBatch
+{
+	std::vector<std::unique_ptr<StagedCia>> _staged_;
+	u64 _cap_;
+	u64 _used_ = 0;
+	Mutex _lock_; // install() may run on several threads
+
+
+public:
+	CiaBatch(u64 cap=BATCH_MEM_CAP) : _cap_(cap) {}
+
+
+	// Returns nullptr if the CIA is too big, compressed or doesn't fit anymore
+	StagedCia* stage(const std::u16string& path, u64 size);
+	void release(StagedCia *cia); // Frees the memory of a CIA which isn't needed anymore
+	InstallStats install(StagedCia *cia, FS_MediaType mediaType);
+	u64  used() {return _used_;}
+};
+
+#endif // _BATCH_H_
@@ -0,0 +1,86 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _BUNDLE_H_
+#define _BUNDLE_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "bytesource.h"
+#include "title.h"
+#include "unzip.h"
+
+
+
+struct BundleEntry
+{
+	std::u16string name;
+	AM_TitleEntry info;
+	unz64_file_pos pos;
+	u64 size; // Uncompressed size in the ZIP
+};
+
+
+// A ZIP file full of CIAs. The title infos are read from the TMDs inside
+// the ZIP and the CIAs are inflated straight into AM without extracting.
+// minizip only supports one open ZIP at a time with our ioapi.
+class CiaBundle
+{
+	unzFile _zip_;
+	std::vector<BundleEntry> _entries_;
+
+	void openEntry(const BundleEntry& entry);
+	void closeEntry(bool checkCrc);
+
+	friend class ZipEntrySource;
+
+
+public:
+	CiaBundle(const std::u16string& path);
+	~CiaBundle() {unzClose(_zip_);}
+
+
+	const std::vector<BundleEntry>& entries() {return _entries_;}
+	InstallStats install(const BundleEntry& entry, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+};
+
+
+
+// Inflates one entry of a CiaBundle. The CRC is checked at the end of stream().
+class ZipEntrySource : public ByteSource
+{
+	CiaBundle& _bundle_;
+	const BundleEntry& _entry_;
+	u64 _pos_ = 0, _readTicks_ = 0;
+
+
+public:
+	ZipEntrySource(CiaBundle& bundle, const BundleEntry& entry) : _bundle_(bundle), _entry_(entry) {}
+
+
+	void stream(ByteSink sink);
+	u64  size() {return _entry_.size;}
+	u64  position() {return _pos_;}
+	u64  readTicks() {return _readTicks_;}
+};
+
+#endif // _BUNDLE_H_
@@ -0,0 +1,144 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#ifndef _BYTESOURCE_H_
+#define _BYTESOURCE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <3ds.h>
+#include "compress.h"
+#include "fs.h"
+
+#define SOCKET_BUF_SIZE  (0x20000)
+
+
+typedef std::function<void (const u8 *data, u32 size)> ByteSink;
+
+
+// A stream of bytes to install. Sources push their data into a sink so
+// they can be chained without copying. The data is only valid during the
+// sink call. stream() must only be called once.
+class ByteSource
+{
+public:
+	virtual ~ByteSource() {}
+
+	virtual void stream(ByteSink sink) = 0;
+	virtual u64  size() = 0;     // Base for the progress. 0 if unknown.
+	virtual u64  position() = 0; // How far stream() got. Same unit as size().
+	// Only valid after stream() returned
+	virtual u64  readTicks() {return 0;}     // Time spent reading
+	virtual u64  prefetchTicks() {return 0;} // Reading done before stream() was called
+	virtual bool verified() {return false;}  // true if the data was fed to a CiaVerifier while reading
+};
+
+
+// A file read through an fs::ReadPipe. Reading starts as soon as the source
+// exists. After stream() the buffers are freed and the file is closed.
+class FileSource : public ByteSource
+{
+	fs::File _file_;
+	u64 _size_;
+	fs::BlockSizeTuner _tuner_;
+	bool _hooked_;
+	std::unique_ptr<fs::ReadPipe> _pipe_;
+	u64 _pos_ = 0, _readTicks_ = 0, _prefetchTicks_ = 0;
+
+
+public:
+	// hook runs on the reader thread for every block, see fs::ReadPipe.
+	// Set probe to false when reading ahead, see fs::BlockSizeTuner.
+	FileSource(const std::u16string& path, tuneKey key, ByteSink hook=nullptr, bool probe=true, FS_Archive& archive=sdmcArchive);
+
+
+	void stream(ByteSink sink);
+	u64  size() {return _size_;}
+	u64  position() {return _pos_;}
+	u64  readTicks() {return _readTicks_;}
+	u64  prefetchTicks() {return _prefetchTicks_;}
+	bool verified() {return _hooked_;}
+};
+
+
+// A block of memory handed out in one piece
+class MemorySource : public ByteSource
+{
+	const u8 *_data_;
+	u64 _size_;
+	u64 _pos_ = 0;
+
+
+public:
+	MemorySource(const u8 *data, u64 size) : _data_(data), _size_(size) {}
+
+
+	void stream(ByteSink sink);
+	u64  size() {return _size_;}
+	u64  position() {return _pos_;}
+};
+
+
+// Decompresses another source. The progress is the one of the compressed source.
+class DecompressSource : public ByteSource
+{
+	std::unique_ptr<ByteSource> _source_;
+	std::unique_ptr<Decompressor> _decompressor_;
+
+
+public:
+	DecompressSource(std::unique_ptr<ByteSource> source, std::unique_ptr<Decompressor> decompressor)
+	                 : _source_(std::move(source)), _decompressor_(std::move(decompressor)) {}
+
+
+	void stream(ByteSink sink);
+	u64  size() {return _source_->size();}
+	u64  position() {return _source_->position();}
+	u64  readTicks() {return _source_->readTicks();}
+	u64  prefetchTicks() {return _source_->prefetchTicks();}
+};
+
+
+// Receives size bytes from a connected socket. The socket stays open.
+// The soc service must be initialized by the caller.
+class SocketSource : public ByteSource
+{
+	int _socket_;
+	u64 _size_;
+	u64 _pos_ = 0, _readTicks_ = 0;
+
+
+public:
+	SocketSource(int socket, u64 size) : _socket_(socket), _size_(size) {}
+
+
+	void stream(ByteSink sink);
+	u64  size() {return _size_;}
+	u64  position() {return _pos_;}
+	u64  readTicks() {return _readTicks_;}
+};
+
+
+// Wraps source in a DecompressSource if name has a compressed file extension
+std::unique_ptr<ByteSource> decompressIfNeeded(std::unique_ptr<ByteSource> source, const std::u16string& name);
+
+#endif // _BYTESOURCE_H_
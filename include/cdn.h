@@ -0,0 +1,70 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _CDN_H_
+#define _CDN_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "title.h"
+
+#define CDN_CERT_CA_SIZE  (0x400)
+#define CDN_CERT_XS_SIZE  (0x300)
+#define CDN_CERT_CP_SIZE  (0x300)
+
+
+
+// A title in CDN layout: a dir with "tmd", "cetk" and one file per content
+// named after the content ID ("0000000a" or "0000000a.app"). install()
+// assembles the CIA stream on the fly and writes it straight to AM.
+// No .cia file is ever written.
+class CdnTitle
+{
+	struct Content
+	{
+		std::u16string path;
+		u64 size;
+	};
+
+	std::u16string _dir_;
+	std::vector<u8> _head_; // CIA header, cert chain, ticket and TMD including padding
+	std::vector<Content> _contents_;
+	AM_TitleEntry _info_;
+	u64 _ciaSize_;
+
+	std::u16string findContent(u32 contentID);
+
+	class Source; // The assembled CIA as ByteSource
+
+
+public:
+	CdnTitle(const std::u16string& dir);
+
+
+	const AM_TitleEntry& info() {return _info_;}
+	u64  ciaSize() {return _ciaSize_;}
+	InstallStats install(FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+
+	static bool isCdnDir(const std::u16string& dir);
+};
+
+#endif // _CDN_H_
@@ -0,0 +1,111 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// Suffixes of the CIAs this build can install for fs::NameFilter
+#ifdef WITH_ZSTD
+	#define CIA_NAME_FILTER u".cia;.cia.lz4;.cia.zst;"
+#else
+	#define CIA_NAME_FILTER u".cia;.cia.lz4;"
+#endif
+
+
+
+// Streaming decompressor. Input can be fed in pieces of any size.
+class Decompressor
+{
+public:
+	virtual ~Decompressor() {}
+
+	// out gets called for every piece of decompressed data. The data is only
+	// valid during the call.
+	virtual void feed(const u8 *data, u32 size, std::function<void (const u8 *data, u32 size)> out) = 0;
+	virtual bool finished() = 0; // true if all frames ended properly
+};
+
+
+// LZ4 frame format decoder. Checksums are skipped. The data we decompress
+// has its own hashes.
+class Lz4Decompressor : public Decompressor
+{
+	enum
+	{
+		LZ4_MAGIC = 0,
+		LZ4_DESCRIPTOR,
+		LZ4_DESCRIPTOR_REST,
+		LZ4_BLOCK_SIZE,
+		LZ4_BLOCK_DATA,
+		LZ4_CONTENT_CHECKSUM,
+		LZ4_SKIPPABLE_SIZE,
+		LZ4_SKIPPABLE_DATA
+	} _state_ = LZ4_MAGIC;
+
+	u8  _hdr_[16];
+	u32 _need_ = 4, _have_ = 0;
+	bool _finished_ = false;
+	bool _blockIndependent_, _blockChecksum_, _contentChecksum_;
+	bool _uncompressedBlock_;
+	u32 _maxBlockSize_ = 0;
+	std::vector<u8> _in_, _out_;
+	u32 _histLen_ = 0;
+
+	void step(std::function<void (const u8 *data, u32 size)>& out);
+	u32  decodeBlock(const u8 *src, u32 srcSize, u8 *dst);
+
+
+public:
+	void feed(const u8 *data, u32 size, std::function<void (const u8 *data, u32 size)> out);
+	bool finished() {return _finished_;}
+};
+
+
+#ifdef WITH_ZSTD
+class ZstdDecompressor : public Decompressor
+{
+	ZSTD_DStream *_stream_;
+	std::vector<u8> _out_;
+	bool _finished_ = false;
+
+
+public:
+	ZstdDecompressor();
+	~ZstdDecompressor() {ZSTD_freeDStream(_stream_);}
+
+	void feed(const u8 *data, u32 size, std::function<void (const u8 *data, u32 size)> out);
+	bool finished() {return _finished_;}
+};
+#endif
+
+
+// Returns a decompressor matching the file extension or nullptr for uncompressed files
+Decompressor* createDecompressor(const std::u16string& path);
+bool isCompressed(const std::u16string& path);
+
+#endif // _COMPRESS_H_
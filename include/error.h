@@ -26,6 +26,8 @@
 #define ERR_NULL_PTR       (-1)
 #define ERR_NOT_ENOUGH_MEM (-2)
 #define ERR_PATH_TOO_LONG  (-3)
+#define ERR_HASH_MISMATCH  (-4)
+#define ERR_BAD_COMPRESSED (-5)
 
 
 
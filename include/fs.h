@@ -21,15 +21,33 @@
 #define _FS_H_
 
 #include <exception>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdio>
 #include <3ds.h>
+#include "thread.h"
 //#include "zip.h"
 
 #define FS_PATH_MAX_LENGTH         (0x106)
+#define DIR_READ_BATCH             (32)       // Entries per FSDIR_Read() call
 #define MAX_BUF_SIZE               (0x200000) // 2 MB
+#define BUFFERED_FILE_WINDOW       (0x10000)  // 64 KB read ahead of a BufferedFile
+#define PIPE_BLOCKS                (3)        // Number of blocks in a ReadPipe ring
+#define TUNE_MIN_BLOCK             (0x20000)  // 128 KB
+#define TUNE_MAX_BLOCK             (0x400000) // 4 MB
+#define TUNE_MEM_CAP               (0xC00000) // 12 MB for all buffers of one transfer
+#define TUNE_PROBE_BLOCKS          (2)        // Blocks measured per candidate size
+#define TUNE_FILE_PATH             u"/sysUpdater.tune"
+#define COPY_SMALL_FILE_SIZE       (0x40000)  // 256 KB. Smaller files are copied by workers in copyDir().
+#define COPY_QUEUE_SIZE            (64)       // Small files waiting for a worker
+#define COPY_WORKERS_OLD3DS        (2)
+#define COPY_WORKERS_NEW3DS        (4)
+#define COPY_INDEX_NAME            u".sysUpdater.copyidx" // Hash index in the root of incremental copyDir() destinations
+#define DIR_CACHE_MAX_ENTRIES      (8192)     // DirEntrys kept by the listing cache of all archives
+#define STAT_CACHE_MAX_ENTRIES     (4096)     // Paths the dir cache knows the type or size of
 #define FS_ERR_DOESNT_EXIST        ((Result)0xC8804478)
 #define FS_ERR_DOES_ALREADY_EXIST  ((Result)0xC82044BE) // Sometimes the API returns 0xC82044B9 instead
 
@@ -53,6 +71,16 @@ public:
 	const Result getErrCode() {return res;}
 };
 
+// Transfer kinds the block size tuner keeps separate results for
+typedef enum
+{
+	TUNE_INSTALL_NAND = 0, // SD -> AM, NAND titles
+	TUNE_INSTALL_SD,       // SD -> AM, SD titles
+	TUNE_COPY_SDMC,        // SD -> SD
+	TUNE_COPY_OTHER,       // Everything involving other archives
+	TUNE_KEY_COUNT
+} tuneKey;
+
 typedef enum
 {
 	FS_SEEK_SET = 0,
@@ -60,17 +88,68 @@ typedef enum
 	FS_SEEK_END,
 } fsSeekMode;
 
+// When File pushes written data to the card
+typedef enum
+{
+	FS_FLUSH_ALWAYS = 0, // Every write is flushed. The default.
+	FS_FLUSH_NEVER,      // Only flush() does. The data is still written on close.
+	FS_FLUSH_ON_CLOSE,
+	FS_FLUSH_EVERY_N     // After every flushInterval bytes
+} fsFlushPolicy;
+
 
 
 namespace fs
 {
+	// Completion handle for File::readAsync() and File::writeAsync().
+	// The buffer must stay valid until the request is done.
+	class IoRequest
+	{
+		friend class IoWorker;
+
+		Handle _fileHandle_;
+		u8 *_buf_;
+		u32 _size_;
+		u64 _offset_;
+		u32 _flags_;
+		bool _write_;
+		u32 _transferred_ = 0;
+		Result _res_ = 0;
+		volatile bool _done_ = false;
+		bool _waited_ = false;
+		Semaphore _signal_;
+
+
+	public:
+		IoRequest(Handle fileHandle, void *buf, u32 size, u64 offset, bool write, u32 flags=0)
+			: _fileHandle_(fileHandle), _buf_((u8*)buf), _size_(size), _offset_(offset), _flags_(flags), _write_(write), _signal_(0, 1) {}
+
+
+		bool done() {return _done_;} // Doesn't wait
+		u32  wait(); // Returns the bytes transferred. Rethrows I/O errors.
+	};
+
+	typedef std::shared_ptr<IoRequest> IoHandle;
+
+
 	class File
 	{
 		u64 _offset_;
 		std::u16string _path_;
-		u32 _openFlags_;
+		u32 _openFlags_ = 0;
 		FS_Archive *_archive_;
 		Handle _fileHandle_ = 0;
+		fsFlushPolicy _flushPolicy_ = FS_FLUSH_ALWAYS;
+		u32 _flushInterval_ = 0;
+		u64 _unflushed_ = 0;
+		std::unique_ptr<u8[]> _combine_;
+		u32 _combineSize_ = 0;
+		u32 _combineFill_ = 0;
+		u64 _combineOffset_ = 0; // File offset of _combine_[0]
+		bool _asyncUsed_ = false;
+
+		u32  writeRaw(const void *buf, u32 size, u64 offset);
+		void writeCombined();
 
 
 	public:
@@ -84,12 +163,22 @@ namespace fs
 		void open(const FS_Path& lowPath, u32 openFlags, FS_Archive& archive=sdmcArchive);
 		u32  read(void *buf, u32 size);
 		u32  write(const void *buf, u32 size);
-		void flush();
+		void flush(); // Writes out combined data too
+		// With combineSize small writes are collected and written in blocks ending
+		// at multiples of combineSize. Bigger aligned writes go straight through.
+		// close() and the destructor still write everything but can't report errors.
+		// Call flush() for that.
+		void setWriteMode(fsFlushPolicy policy, u32 combineSize=0, u32 flushInterval=0);
+		// Requests run in order on one I/O thread so the caller can compute
+		// meanwhile. They don't move tell(). flush() and close() wait for them.
+		// Wait for a request before other calls touch the same bytes.
+		IoHandle readAsync(void *buf, u32 size, u64 offset);
+		IoHandle writeAsync(const void *buf, u32 size, u64 offset);
 		void seek(const u64 offset, fsSeekMode mode);
 		u64  tell() {return _offset_;}
 		u64  size();
 		void setSize(const u64 size);
-		void close() {if(_fileHandle_) FSFILE_Close(_fileHandle_); _fileHandle_ = 0;}
+		void close();
 		void move(const std::u16string& dst, FS_Archive& dstArchive=sdmcArchive);
 		u64  copy(const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& dstArchive=sdmcArchive);
 		void del(); // Delete the currently opened file
@@ -100,6 +189,185 @@ namespace fs
 	};
 
 
+	// Reads through a window of windowSize bytes so many small reads cost
+	// one FSFILE_Read(). Seeking inside the window is free. A read just
+	// before the window refills it so it ends there, which suits callers
+	// reading a file backwards. Reads of windowSize and more bypass it.
+	// write() goes straight to the file and drops the window.
+	class BufferedFile
+	{
+		File _file_;
+		std::unique_ptr<u8[]> _window_;
+		u32 _windowSize_;
+		u32 _windowFill_ = 0;
+		u64 _windowOffset_ = 0; // File offset of _window_[0]
+		u64 _offset_ = 0;
+		u64 _size_ = 0;
+		bool _sizeKnown_ = false; // Only for read only files
+
+
+	public:
+		BufferedFile(u32 windowSize=BUFFERED_FILE_WINDOW) : _windowSize_(windowSize) {}
+		BufferedFile(const std::u16string& path, u32 openFlags, FS_Archive& archive=sdmcArchive, u32 windowSize=BUFFERED_FILE_WINDOW)
+			: _windowSize_(windowSize) {open(path, openFlags, archive);}
+
+
+		void open(const std::u16string& path, u32 openFlags, FS_Archive& archive=sdmcArchive);
+		void close();
+		u32  read(void *buf, u32 size);
+		u32  write(const void *buf, u32 size);
+		void seek(const u64 offset, fsSeekMode mode);
+		u64  tell() {return _offset_;}
+		u64  size();
+		void flush() {_file_.flush();}
+		void setWriteMode(fsFlushPolicy policy, u32 combineSize=0, u32 flushInterval=0) {_file_.setWriteMode(policy, combineSize, flushInterval);}
+	};
+
+
+	// Finds the fastest block size for a transfer kind. The first blocks of
+	// a transfer are read with different sizes and timed. The winner is saved
+	// to TUNE_FILE_PATH and used right away by later transfers of that kind.
+	// sizeFor() may be called from a reader thread while record() is called
+	// from the consumer. Tuners of different transfers may run side by side.
+	// Only a probing tuner hands out blocks bigger than the tuned size.
+	class BlockSizeTuner
+	{
+		tuneKey _key_;
+		u32 _maxBlockSize_;
+		u32 _candidates_[8];
+		u64 _ticks_[8];
+		u32 _candidateCount_ = 0;
+		u32 _recorded_ = 0;
+		u64 _lastTick_;
+		volatile u32 _best_;
+		volatile bool _probing_ = false;
+
+		static u32 _tunedSizes_[2][TUNE_KEY_COUNT]; // [isNew3DS][key]
+		static u8 _console_; // 0xFF until loaded
+		static Mutex _lock_; // Guards the statics
+		static void load();  // Call these two with _lock_ held
+		static void save();
+
+
+	public:
+		// bufferCount is the number of maxBlockSize() buffers the caller allocates.
+		// Set probe to false if the timings would be skewed, e.g. by read ahead.
+		BlockSizeTuner(tuneKey key, u64 transferSize, u32 bufferCount=1, bool probe=true);
+
+
+		u32  maxBlockSize() {return _maxBlockSize_;}
+		u32  sizeFor(u32 blockIndex);
+		void record(u32 blockSize); // Call after each block is fully transferred
+	};
+
+
+	// Reads a file on its own thread into a ring of buffers so the caller
+	// can write out one block while the next ones are read. If no thread
+	// can be created next() reads each block itself. The file must not be
+	// touched by anyone else as long as the pipe exists.
+	class ReadPipe
+	{
+		File& _file_;
+		BlockSizeTuner *_tuner_ = nullptr;
+		std::function<void (const u8 *block, u32 size)> _hook_;
+		u64 _remaining_;
+		u32 _blockSize_;
+		u32 _blockCount_;
+		u8 *_mem_;
+		u32 *_sizes_;
+		u32 _heldSize_ = 0;
+		u32 _readPos_ = 0, _consumePos_ = 0, _blockIndex_ = 0;
+		bool _holding_ = false;
+		volatile bool _abort_ = false;
+		volatile Result _err_ = 0;
+		u64 _readTicks_ = 0;
+		Mutex _statsLock_;
+		Semaphore _free_, _filled_;
+		WorkerThread *_thread_ = nullptr;
+
+		void start();
+		void readerFunc();
+		bool readBlock(); // false after the last block
+
+
+	public:
+		ReadPipe(File& file, u32 blockSize=MAX_BUF_SIZE, u32 blockCount=PIPE_BLOCKS);
+		// hook runs on the reader thread (or in next() without one) for every
+		// block right after it was read. It must not throw.
+		ReadPipe(File& file, BlockSizeTuner& tuner, std::function<void (const u8 *block, u32 size)> hook=nullptr, u32 blockCount=PIPE_BLOCKS);
+		~ReadPipe();
+
+
+		// Returns the next block and its size. 0 means end of file.
+		// The block stays valid until the next call.
+		u32  next(u8 **block);
+		void abort();
+		u64  readTicks(); // Time the reader spent reading and in the hook so far
+	};
+
+
+	// Jobs for the worker threads of SmallFileCopier and BulkDeleter. Each
+	// worker owns scratchSize bytes it passes to the jobs it runs. Workers
+	// only run when archive and otherArchive are the SD card. Without
+	// workers add() runs the job right away.
+	// Job errors are rethrown by add(), collect() and wait().
+	class WorkQueue
+	{
+	public:
+		typedef std::function<void (u8 *scratch)> Job;
+
+
+	private:
+		const u32 _scratchSize_;
+		std::deque<Job> _jobs_;
+		Mutex _lock_;
+		Semaphore _free_, _queued_, _done_;
+		std::vector<std::unique_ptr<WorkerThread>> _workers_;
+		std::unique_ptr<fsException> _error_;
+		u32 _added_ = 0, _collected_ = 0;
+		volatile bool _stop_ = false;
+
+		void workerFunc();
+		void checkError();
+		void runJob(const Job& job, u8 *scratch);
+
+
+	public:
+		WorkQueue(u32 scratchSize, FS_Archive& archive, FS_Archive& otherArchive);
+		~WorkQueue();
+
+
+		void add(Job job); // Waits if the queue is full
+		u32  collect();    // Returns how many jobs finished since the last call. Doesn't wait.
+		u32  wait();       // Waits for all jobs. Returns the same as collect().
+	};
+
+
+	// Copies small files on worker threads. For small files the time goes
+	// into opening, creating and closing files. These are IPC round trips
+	// the workers can wait for side by side. On the New 3DS half of the
+	// workers run on the extra core if the app may use it. Copies from or
+	// to other archives than the SD card are done right away by add().
+	// Worker errors are rethrown by add(), collect() and wait().
+	class SmallFileCopier
+	{
+		FS_Archive& _srcArchive_;
+		FS_Archive& _dstArchive_;
+		WorkQueue _queue_;
+
+
+	public:
+		SmallFileCopier(FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+
+
+		// Waits if the queue is full. If hash isn't nullptr it gets the SHA-256
+		// of the file. It must stay valid until wait() returned.
+		void add(const std::u16string& src, const std::u16string& dst, u8 *hash=nullptr);
+		u32  collect() {return _queue_.collect();} // Returns how many copies finished since the last call. Doesn't wait.
+		u32  wait() {return _queue_.wait();}       // Waits for all copies. Returns the same as collect().
+	};
+
+
 	// Other file functions
 	bool fileExist(const std::u16string& path, FS_Archive& archive=sdmcArchive);
 	void moveFile(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
@@ -114,6 +382,21 @@ namespace fs
 		u64 size; // Total size of the directory
 	};
 
+	struct CopyStats
+	{
+		u64 copiedBytes;
+		u64 skippedBytes; // Files which already matched at the destination
+	};
+
+	struct DeleteStats
+	{
+		u32 fileCount;
+		u32 dirCount;
+		u64 ticks;
+
+		u32 objectsPerSec() const {return (ticks ? (u64)(fileCount + dirCount) * SYSCLOCK_ARM11 / ticks : 0);}
+	};
+
 	struct DirEntry
 	{
 		std::u16string name;
@@ -124,15 +407,196 @@ namespace fs
 	};
 
 
+	//===============================================
+	// class NameFilter                            ||
+	//===============================================
+	// Compiled listDirContents() filter like ".cia;.cia.lz4;!.*;". Entries without
+	// wildcards match the end of the name, entries with * or ? the whole name.
+	// Entries starting with '!' exclude. Case is ignored for A-Z.
+	// Includes only apply to files, excludes to dirs too.
+	class NameFilter
+	{
+		struct Pattern
+		{
+			std::u16string text; // Lower case
+			bool glob;
+		};
+
+		std::vector<Pattern> _includes_;
+		std::vector<Pattern> _excludes_;
+
+
+		static bool matchPattern(const Pattern& pattern, const u16 *name, u32 length);
+
+
+	public:
+		explicit NameFilter(const std::u16string& filter=u"");
+
+		bool match(const u16 *name, u32 length, bool isDir) const;
+		bool match(const std::u16string& name, bool isDir) const {return match((const u16*)name.c_str(), name.length(), isDir);}
+		bool empty() const {return _includes_.empty() && _excludes_.empty();}
+	};
+
+
+	//===============================================
+	// class DirStream                             ||
+	//===============================================
+	// Yields the entries of a dir straight from the FSDIR_Read() batches in
+	// the order the FS returns them. Memory use doesn't depend on the dir size.
+	// Use listDirContents() for a sorted vector.
+	//
+	// for(auto& it : fs::DirStream(u"/updates")) ...
+	//
+	// The entry is overwritten by the next one. Copy it to keep it.
+	class DirStream
+	{
+		Handle _dirHandle_ = 0;
+		const NameFilter _filter_;
+		std::unique_ptr<FS_DirectoryEntry[]> _batch_;
+		u32 _count_ = 0, _pos_ = 0;
+		bool _lastBatch_ = false;
+		DirEntry _entry_;
+
+
+	public:
+		class iterator
+		{
+			DirStream *_stream_;
+
+		public:
+			iterator(DirStream *stream) : _stream_(stream) {}
+
+			const DirEntry& operator *() const {return _stream_->_entry_;}
+			const DirEntry* operator ->() const {return &_stream_->_entry_;}
+			iterator& operator ++() {if(!_stream_->next()) _stream_ = nullptr; return *this;}
+			bool operator !=(const iterator& other) const {return _stream_ != other._stream_;}
+		};
+
+
+		DirStream(const std::u16string& path, const NameFilter& filter=NameFilter(), FS_Archive& archive=sdmcArchive);
+		DirStream(const DirStream&) = delete;
+		DirStream& operator =(const DirStream&) = delete;
+		~DirStream();
+
+
+		bool next(); // false at the end
+		const DirEntry& entry() const {return _entry_;}
+
+		iterator begin() {return iterator(next() ? this : nullptr);}
+		iterator end() {return iterator(nullptr);}
+	};
+
+
+	//===============================================
+	// class DirWalker                             ||
+	//===============================================
+	// Depth first walk over a dir tree. Every dir is listed exactly once
+	// and kept on a stack while its children are walked.
+	class DirWalker
+	{
+		struct Level
+		{
+			std::vector<DirEntry> entries;
+			size_t pos;
+		};
+
+		FS_Archive& _archive_;
+		std::u16string _path_;
+		std::vector<Level> _stack_;
+		const DirEntry *_entry_;
+		bool _descend_;  // List _path_ on the next call
+		bool _hasName_;  // _path_ ends with the name of the last entry
+		u32 _listings_;
+
+
+	public:
+		enum Event
+		{
+			WALK_DIR,      // Entering a dir. path() is the dir.
+			WALK_FILE,     // path() is the file
+			WALK_DIR_DONE, // All children of path() were walked
+			WALK_END
+		};
+
+		struct Step
+		{
+			Event event;
+			std::u16string name;
+			u64 size;
+		};
+
+
+		DirWalker(const std::u16string& root, FS_Archive& archive=sdmcArchive);
+
+		Event next();
+		void skip(); // Don't descend into the dir of the last WALK_DIR
+		std::vector<Step> steps(); // Walks the rest of the tree and records it
+
+		const std::u16string& path() const {return _path_;}
+		const DirEntry& entry() const {return *_entry_;}
+		u32 depth() const {return (_stack_.empty() ? 0 : _stack_.size() - 1);}
+		u32 listings() const {return _listings_;}
+	};
+
+
+	//===============================================
+	// class DirCounter                            ||
+	//===============================================
+	// Counts a dir tree in the background. Workers take dirs from a shared
+	// queue, list them and queue the subdirs they find, so subtrees are
+	// counted side by side. The listings end up in the dir cache. Other
+	// archives than the SD card are counted right away by the constructor.
+	// Worker errors are rethrown by wait().
+	class DirCounter
+	{
+		FS_Archive& _archive_;
+		std::deque<std::u16string> _dirs_;
+		DirInfo _info_ = {0, 0, 0};
+		u32 _pending_ = 1; // Dirs queued or being listed
+		Mutex _lock_;
+		Semaphore _queued_, _finished_;
+		std::vector<std::unique_ptr<WorkerThread>> _workers_;
+		std::unique_ptr<fsException> _error_;
+		volatile bool _stop_ = false;
+		volatile bool _done_ = false;
+
+		void workerFunc();
+		void countDir(const std::u16string& path);
+
+
+	public:
+		DirCounter(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+		~DirCounter(); // Stops counting if not done yet
+
+
+		bool    done() const {return _done_;}
+		DirInfo wait();
+		DirInfo partial(); // Counted so far. Doesn't wait.
+	};
+
+
 	// Directory functions
 	bool dirExist(const std::u16string& path, FS_Archive& archive=sdmcArchive);
 	void makeDir(const std::u16string& path, FS_Archive& archive=sdmcArchive);
 	void makePath(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	DirInfo getDirInfo(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+	DirInfo getDirInfo(const std::u16string& path, FS_Archive& archive=sdmcArchive); // Uses a DirCounter
 	std::vector<DirEntry> listDirContents(const std::u16string& path, const std::u16string filter=u"", FS_Archive& archive=sdmcArchive);
+	std::vector<DirEntry> listDirContents(const std::u16string& path, const NameFilter& filter, FS_Archive& archive=sdmcArchive);
+	// Dirs first, then by name ignoring A-Z case with numbers compared by value.
+	// With count only the first count entries are sorted. The rest follow in no order.
+	void sortDirEntries(std::vector<DirEntry>& entries, size_t count=0);
 	void moveDir(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	void copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	void deleteDir(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+	// With incremental set files with the same size and SHA-256 at the destination are skipped.
+	// The destination hashes are cached in COPY_INDEX_NAME. Entries are trusted if the size matches.
+	// With estimate set copying starts right away and totalPercent is based on what the
+	// DirCounter found so far until it's done. It never goes back and stays below 100 until the end.
+	CopyStats copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive, bool incremental=false, bool estimate=false);
+	// "/" goes through deleteTree(). Other dirs are deleted with one recursive
+	// FS call so their stats only have the ticks.
+	DeleteStats deleteDir(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+	// Walks the tree once. Files are deleted on workers while walking, then the dirs
+	// level by level from the bottom. Worth it for big trees and the root.
+	DeleteStats deleteTree(const std::u16string& path, FS_Archive& archive=sdmcArchive);
 
 
 	// Zip functions
@@ -145,6 +609,7 @@ namespace fs
 
 
 	// Misc functions
+	void clearDirCache(); // Call if something outside of fs changed the FS
 	void addToPath(std::u16string& path, const std::u16string& dirOrFile);
 	void removeFromPath(std::u16string& path);
 } // namespace fs
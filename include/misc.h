@@ -44,6 +44,11 @@ public:
 	T& operator [](u32 element) {return ptr[element];}
 };
 
+// Big endian readers for Nintendo file formats
+inline u16 getBe16(const u8 *p) {return p[0]<<8 | p[1];}
+inline u32 getBe32(const u8 *p) {return (u32)p[0]<<24 | p[1]<<16 | p[2]<<8 | p[3];}
+inline u64 getBe64(const u8 *p) {return (u64)getBe32(p)<<32 | getBe32(p + 4);}
+
 bool fileNameCmp(fs::DirEntry& first, fs::DirEntry& second);
 
 #endif // _MISC_H_
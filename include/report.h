@@ -0,0 +1,65 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "title.h"
+
+#define REPORT_PATH     u"/updates/installReport.csv"
+#define TICKS_PER_MSEC  (SYSCLOCK_ARM11 / 1000)
+
+
+
+// Collects the timings of every installed title and writes them as CSV
+// together with a summary line of the whole run. The file is rewritten on
+// every run so it always describes the last one.
+class InstallReport
+{
+	struct Row
+	{
+		std::string name;
+		u64 titleID;
+		u16 version;
+		InstallStats stats;
+		u64 firmTicks;
+		u64 totalTicks;
+	};
+
+	std::vector<Row> _rows_;
+	u64 _startTick_;
+
+
+public:
+	InstallReport() : _startTick_(svcGetSystemTick()) {}
+
+
+	void add(const std::u16string& name, const AM_TitleEntry& entry, const InstallStats& stats, u64 firmTicks, u64 totalTicks);
+	// Never throws. A failing report must not fail the update.
+	void save(bool complete, const std::u16string& path=REPORT_PATH);
+	u32  verifiedContents() const; // Of all titles added so far
+	u32  skippedContents() const;
+};
+
+#endif // _REPORT_H_
@@ -0,0 +1,49 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <3ds.h>
+
+#define SHA256_HASH_SIZE  (0x20)
+
+
+
+class Sha256
+{
+	u32 _state_[8];
+	u8  _block_[64];
+	u32 _blockLen_;
+	u64 _totalLen_;
+
+	void transform(const u8 *data);
+
+
+public:
+	Sha256() {reset();}
+
+
+	void reset();
+	void update(const void *data, u32 size);
+	void finish(u8 *hash); // hash must be SHA256_HASH_SIZE bytes
+};
+
+#endif // _SHA256_H_
@@ -0,0 +1,141 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <functional>
+
+#define THREAD_STACK_SIZE  (0x4000)
+
+
+
+// The libctru backend is used on the 3DS. Host builds (tools, tests on
+// Linux) get the same classes on top of std::thread.
+#ifdef _3DS
+
+#include <3ds.h>
+
+class Semaphore
+{
+	Handle _handle_;
+
+
+public:
+	Semaphore(s32 initialCount, s32 maxCount) {svcCreateSemaphore(&_handle_, initialCount, maxCount);}
+	~Semaphore() {svcCloseHandle(_handle_);}
+
+	void acquire() {svcWaitSynchronization(_handle_, U64_MAX);}
+	bool tryAcquire() {return !svcWaitSynchronization(_handle_, 0);} // Doesn't wait
+	void release(s32 count=1) {s32 tmp; svcReleaseSemaphore(&tmp, _handle_, count);}
+};
+
+
+class Mutex
+{
+	LightLock _lock_;
+
+
+public:
+	Mutex() {LightLock_Init(&_lock_);}
+
+	void lock() {LightLock_Lock(&_lock_);}
+	void unlock() {LightLock_Unlock(&_lock_);}
+};
+
+#else
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+class Semaphore
+{
+	std::mutex _lock_;
+	std::condition_variable _cond_;
+	int _count_, _maxCount_;
+
+
+public:
+	Semaphore(int initialCount, int maxCount) : _count_(initialCount), _maxCount_(maxCount) {}
+
+	void acquire() {std::unique_lock<std::mutex> lock(_lock_); _cond_.wait(lock, [this]() {return _count_ > 0;}); _count_--;}
+	bool tryAcquire() {std::lock_guard<std::mutex> lock(_lock_); return _count_ > 0 && _count_--;}
+	void release(int count=1) {std::lock_guard<std::mutex> lock(_lock_); _count_ = std::min(_count_ + count, _maxCount_); _cond_.notify_all();}
+};
+
+
+class Mutex
+{
+	std::mutex _lock_;
+
+
+public:
+	void lock() {_lock_.lock();}
+	void unlock() {_lock_.unlock();}
+};
+
+#endif // _3DS
+
+
+class LockGuard
+{
+	Mutex& _mutex_;
+
+
+public:
+	LockGuard(Mutex& mutex) : _mutex_(mutex) {_mutex_.lock();}
+	~LockGuard() {_mutex_.unlock();}
+};
+
+
+// Runs func on a new thread. The thread gets a slightly higher priority
+// than the creating thread because it mostly sleeps in IPC calls and
+// should resubmit requests as soon as they complete.
+// func must not throw. Catch everything inside it and hand errors over.
+// Check started() because thread creation fails if we run out of threads.
+// core and stackSize are ignored by the host backend.
+class WorkerThread
+{
+	std::function<void ()> _func_;
+#ifdef _3DS
+	Thread _thread_ = nullptr;
+
+	static void entry(void *arg) {((WorkerThread*)arg)->_func_();}
+#else
+	std::thread _thread_;
+#endif
+
+
+public:
+	WorkerThread(std::function<void ()> func, int core=-2, size_t stackSize=THREAD_STACK_SIZE);
+	~WorkerThread() {join();}
+
+#ifdef _3DS
+	bool started() {return _thread_ != nullptr;}
+#else
+	bool started() {return _thread_.joinable();}
+#endif
+	void join();
+};
+
+#endif // _THREAD_H_
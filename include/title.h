@@ -21,10 +21,21 @@
 #define _TITLE_H_
 
 #include <exception>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdio>
 #include <3ds.h>
+#include "bytesource.h"
+#include "fs.h"
+#include "sha256.h"
+
+#define CIA_HEADER_SIZE   (0x2020)
+#define CIA_MAX_TMD_SIZE  (0x100000) // Way more than any real TMD needs
+#define CIA_ALIGN(x)      (((x) + 63) & ~63ULL) // CIA sections are 64 byte aligned
+#define TMD_HEADER_SIZE   (0xC4 + 0x900)        // Including the content info records
+#define TICKET_DATA_SIZE  (0x210)
 
 class titleException : public std::exception
 {
@@ -91,8 +102,135 @@ struct Icon
 };
 
 
+// Follows a CIA byte stream and checks the SHA-256 of every content
+// against the hash in the TMD of the same CIA while it passes by.
+// Encrypted contents can't be checked because the hashes are over the
+// decrypted data and we have no access to the title key. Those are skipped.
+class CiaVerifier
+{
+	struct Content
+	{
+		u64 size;
+		u8  hash[SHA256_HASH_SIZE];
+		bool encrypted;
+	};
+
+	enum
+	{
+		STATE_HEADER = 0,
+		STATE_TMD,
+		STATE_CONTENT,
+		STATE_DONE
+	} _state_ = STATE_HEADER;
+
+	u64 _pos_ = 0;
+	u8  _header_[CIA_HEADER_SIZE];
+	std::vector<u8> _tmd_;
+	u32 _tmdFill_ = 0;
+	u64 _tmdOffset_ = 0, _contentOffset_ = 0;
+	std::vector<Content> _contents_;
+	u32 _curContent_ = 0;
+	u64 _curLeft_ = 0;
+	Sha256 _sha_;
+	volatile bool _failed_ = false;
+	bool _tmdParsed_ = false;
+	u64 _titleID_ = 0, _titleSize_ = 0;
+	u16 _version_ = 0;
+	u32 _verified_ = 0, _skipped_ = 0;
+	u64 _hashedBytes_ = 0, _hashTicks_ = 0;
+
+	void parseHeader();
+	void parseTmd();
+	void nextContent();
+
+
+public:
+	void feed(const u8 *data, u32 size);
+
+	bool failed() {return _failed_;}
+	bool tmdParsed() {return _tmdParsed_;}
+	void getTitleEntry(AM_TitleEntry& entry); // Only valid after tmdParsed() returned true
+	u32  verifiedContents() {return _verified_;}
+	u32  skippedContents() {return _skipped_;}
+	u64  hashedBytes() {return _hashedBytes_;}
+	u64  hashTicks() {return _hashTicks_;} // Time spent hashing in system ticks
+};
+
+
+
+// Where the time of one installation went. All times are in system ticks.
+struct InstallStats
+{
+	u64 bytes;         // Bytes written to AM
+	u64 readTicks;     // Reading the source. Overlaps the writes for pipelined sources.
+	u64 writeTicks;    // Writing to AM
+	u64 finishTicks;   // AM_FinishCiaInstall
+	u64 prefetchTicks; // Reading done before the installation started
+	u32 verifiedContents; // Contents whose hash matched the TMD
+	u32 skippedContents;  // Encrypted contents which can't be checked
+};
+
+
+// Owns an AM CIA install handle. Everything written goes through a
+// CiaVerifier first. If the object dies before finish() was called the
+// installation gets cancelled with AM_CancelCIAInstall.
+class CiaInstaller
+{
+	FS_MediaType _mediaType_;
+	fs::File _cia_;
+	CiaVerifier _verifier_;
+	InstallStats _stats_ = {0, 0, 0, 0, 0, 0, 0};
+	bool _finished_ = false;
+
+
+public:
+	// With start set to false AM isn't touched until start() is called
+	CiaInstaller(FS_MediaType mediaType, bool start=true);
+	~CiaInstaller() {cancel();}
+
+
+	void start(); // Does nothing if already started
+	// Set alreadyVerified if the data was fed to verifier() by someone else
+	void write(const u8 *data, u32 size, bool alreadyVerified=false);
+	void finish();
+	void cancel();
+	CiaVerifier& verifier() {return _verifier_;}
+	InstallStats& stats() {return _stats_;} // The owner adds the read times
+};
+
+
+
+// A CIA file on the SD card. It is opened and read in the background as
+// soon as the object exists but AM is only touched by install(). This lets
+// installUpdates() read ahead the next title while AM finalizes the
+// current one. With prefetch set the block size tuner doesn't probe because
+// the read ahead blocks would make the first candidates look too fast.
+class CiaFile
+{
+	std::u16string _path_;
+	CiaInstaller _installer_;
+	std::unique_ptr<ByteSource> _source_; // Declared last so it stops before the installer dies
+
+
+public:
+	CiaFile(const std::u16string& path, FS_MediaType mediaType, bool prefetch=false);
+
+
+	// streamed is called after all data was handed to AM and the file was
+	// closed but before AM_FinishCiaInstall. It must not throw.
+	InstallStats install(std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, std::function<void ()> streamed=nullptr);
+};
+
+
+
 std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType);
-void installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+u32 getSignatureSize(u32 sigType);
+AM_TitleEntry getCiaFileInfo(const std::u16string& path, FS_MediaType mediaType);
+InstallStats installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+// The install loop every CIA goes through. name is only passed to the callback.
+// streamed is called after the source ended but before AM_FinishCiaInstall. It must not throw.
+InstallStats installCia(ByteSource& source, CiaInstaller& installer, const std::u16string& name, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, std::function<void ()> streamed=nullptr);
+InstallStats installCia(ByteSource& source, FS_MediaType mediaType, const std::u16string& name, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
 void deleteTitle(FS_MediaType mediaType, u64 titleID);
 //bool launchTitle(FS_MediaType mediaType, u8 flags, u64 titleID); // On applet launch it returns false if the applet can't be lauched
 #define relaunchApp() launchTitle(mediatype_SDMC, 2, 0)
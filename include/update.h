@@ -0,0 +1,32 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _UPDATE_H_
+#define _UPDATE_H_
+
+
+
+// Installs every title in /updates (CIAs, compressed CIAs, CDN dirs and
+// updates.zip) which is newer than the installed one. Firmware, modules
+// and applets are installed one after another in a fixed order. Runs of
+// system data archives are installed side by side.
+// If downgrade is true we don't care about versions (except equal versions) and uninstall newer versions.
+void installUpdates(bool downgrade);
+
+#endif // _UPDATE_H_
@@ -0,0 +1,80 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "batch.h"
+#include "bytesource.h"
+#include "compress.h"
+#include "fs.h"
+#include "title.h"
+
+#define _FILE_ "batch.cpp" // Replacement for __FILE__ without the path
+
+
+
+StagedCia* CiaBatch::stage(const std::u16string& path, u64 size)
+{
+	if(!size || size>BATCH_MAX_CIA_SIZE || _used_ + size>_cap_ || isCompressed(path)) return nullptr;
+
+	std::unique_ptr<StagedCia> cia(new StagedCia);
+	CiaVerifier verifier;
+	u64 startTick = svcGetSystemTick();
+
+
+	cia->data.resize(size);
+	fs::File ciaFile(path, FS_OPEN_READ);
+	if(ciaFile.read(&cia->data[0], size) != size) throw fsException(_FILE_, __LINE__, FS_ERR_DOESNT_EXIST, "CIA file shrunk while reading!");
+	cia->readTicks = svcGetSystemTick() - startTick;
+
+	// Broken content is caught again at install time. If there isn't even a
+	// TMD the normal path lets AM report the error.
+	verifier.feed(&cia->data[0], size);
+	if(!verifier.tmdParsed()) return nullptr;
+	verifier.getTitleEntry(cia->info);
+
+	_used_ += size;
+	_staged_.push_back(std::move(cia));
+	return _staged_.back().get();
+}
+
+
+void CiaBatch::release(StagedCia *cia)
+{
+	LockGuard lock(_lock_);
+
+	_used_ -= cia->data.size();
+	std::vector<u8>().swap(cia->data); // clear() keeps the memory
+}
+
+
+InstallStats CiaBatch::install(StagedCia *cia, FS_MediaType mediaType)
+{
+	// One write. The whole CIA is hashed before AM sees any of it.
+	MemorySource source(&cia->data[0], cia->data.size());
+	InstallStats stats = installCia(source, mediaType, u"");
+	release(cia);
+
+	stats.readTicks = cia->readTicks;
+	return stats;
+}
@@ -0,0 +1,170 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "bundle.h"
+#include "compress.h"
+#include "error.h"
+#include "fs.h"
+#include "misc.h"
+#include "title.h"
+#include "unzip.h"
+
+#define _FILE_ "bundle.cpp" // Replacement for __FILE__ without the path
+
+
+
+// Ignores A-Z case like the file listing does
+static bool isCiaName(const std::u16string& name)
+{
+	static const fs::NameFilter filter(CIA_NAME_FILTER);
+
+	return filter.match(name, false);
+}
+
+
+CiaBundle::CiaBundle(const std::u16string& path)
+{
+	Buffer<char> zipFilePath(256);
+	Buffer<char16_t> name(256);
+	Buffer<u8> buf(0x4000, false);
+	unz_file_info64 fInfo;
+	BundleEntry entry;
+	int res;
+
+
+
+	_zip_ = unzOpen64(path.c_str());
+	if(!_zip_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Failed to open ZIP file!");
+
+	res = unzGoToFirstFile(_zip_);
+	while(res == UNZ_OK)
+	{
+		zipFilePath.clear();
+		if((res = unzGetCurrentFileInfo64(_zip_, &fInfo, &zipFilePath, 255, nullptr, 0, nullptr, 0)) != UNZ_OK)
+			throw fsException(_FILE_, __LINE__, res, "Failed to get current file info (ZIP)!");
+
+		name.clear();
+		utf8_to_utf16((u16*)&name, (u8*)&zipFilePath, 255);
+		entry.name = &name;
+
+		if(!(fInfo.external_fa & 0x10) && isCiaName(entry.name))
+		{
+			// 0 = none, 8 = deflate
+			if(fInfo.compression_method != 0 && fInfo.compression_method != 8)
+				throw fsException(_FILE_, __LINE__, fInfo.compression_method, "Unsupported compression method. Use deflate!");
+
+			if((res = unzGetFilePos64(_zip_, &entry.pos)) != UNZ_OK) throw fsException(_FILE_, __LINE__, res, "Failed to get file position in ZIP!");
+			entry.size = fInfo.uncompressed_size;
+
+
+			// Inflate only the start of the CIA until we have the TMD
+			std::unique_ptr<Decompressor> decompressor(createDecompressor(entry.name));
+			CiaVerifier verifier;
+			int bytesRead;
+
+			openEntry(entry);
+			while(!verifier.tmdParsed() && (bytesRead = unzReadCurrentFile(_zip_, &buf, buf.size())) > 0)
+			{
+				if(decompressor) decompressor->feed(&buf, bytesRead, [&verifier](const u8 *data, u32 size) {verifier.feed(data, size);});
+				else verifier.feed(&buf, bytesRead);
+			}
+			closeEntry(false);
+			if(!verifier.tmdParsed()) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Failed to find the TMD of a CIA in the ZIP!");
+
+			verifier.getTitleEntry(entry.info);
+			_entries_.push_back(entry);
+		}
+
+		res = unzGoToNextFile(_zip_);
+	}
+	if(res != UNZ_END_OF_LIST_OF_FILE) throw fsException(_FILE_, __LINE__, res, "Failed to read ZIP directory!");
+}
+
+
+void CiaBundle::openEntry(const BundleEntry& entry)
+{
+	int res;
+
+	if((res = unzGoToFilePos64(_zip_, &entry.pos)) != UNZ_OK) throw fsException(_FILE_, __LINE__, res, "Failed to seek in ZIP!");
+	if((res = unzOpenCurrentFile(_zip_)) != UNZ_OK) throw fsException(_FILE_, __LINE__, res, "Failed to open file in ZIP!");
+}
+
+
+// The CRC is only checked if the whole file was read
+void CiaBundle::closeEntry(bool checkCrc)
+{
+	int res = unzCloseCurrentFile(_zip_);
+
+	if(checkCrc && res != UNZ_OK) throw fsException(_FILE_, __LINE__, res, "Failed to close file in ZIP (CRC error?)!");
+}
+
+
+InstallStats CiaBundle::install(const BundleEntry& entry, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	std::unique_ptr<ByteSource> source = decompressIfNeeded(std::unique_ptr<ByteSource>(new ZipEntrySource(*this, entry)), entry.name);
+
+	return installCia(*source, mediaType, entry.name, callback);
+}
+
+
+//===============================================
+// class ZipEntrySource                        ||
+//===============================================
+
+void ZipEntrySource::stream(ByteSink sink)
+{
+	Buffer<u8> buf(MAX_BUF_SIZE, false);
+	int bytesRead;
+	u64 startTick;
+
+
+
+	_bundle_.openEntry(_entry_);
+
+	try
+	{
+		while(1)
+		{
+			startTick = svcGetSystemTick();
+			bytesRead = unzReadCurrentFile(_bundle_._zip_, &buf, MAX_BUF_SIZE);
+			_readTicks_ += svcGetSystemTick() - startTick;
+			if(bytesRead<=0) break;
+
+			_pos_ += bytesRead;
+			sink(&buf, bytesRead);
+		}
+		if(bytesRead < 0) throw fsException(_FILE_, __LINE__, bytesRead, "Failed to read file in ZIP!");
+	} catch(fsException& e)
+	{
+		_bundle_.closeEntry(false);
+		throw;
+	} catch(titleException& e)
+	{
+		_bundle_.closeEntry(false);
+		throw;
+	}
+
+	// A CRC error must cancel the installation so it is checked before AM finishes
+	_bundle_.closeEntry(true);
+}
@@ -0,0 +1,132 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <3ds.h>
+#include "bytesource.h"
+#include "compress.h"
+#include "error.h"
+#include "fs.h"
+#include "misc.h"
+#include "title.h"
+
+#define _FILE_ "bytesource.cpp" // Replacement for __FILE__ without the path
+
+
+
+//===============================================
+// class FileSource                            ||
+//===============================================
+
+FileSource::FileSource(const std::u16string& path, tuneKey key, ByteSink hook, bool probe, FS_Archive& archive)
+                       : _file_(path, FS_OPEN_READ, archive), _size_(_file_.size()), _tuner_(key, _size_, PIPE_BLOCKS, probe), _hooked_(hook != nullptr)
+{
+	_pipe_.reset(new fs::ReadPipe(_file_, _tuner_, hook));
+}
+
+
+void FileSource::stream(ByteSink sink)
+{
+	u8 *block;
+	u32 blockSize;
+
+
+	_prefetchTicks_ = _pipe_->readTicks();
+
+	while((blockSize = _pipe_->next(&block)))
+	{
+		_pos_ += blockSize;
+		sink(block, blockSize);
+	}
+
+	// Free the buffers and the file so the next source can start reading
+	_readTicks_ = _pipe_->readTicks();
+	_pipe_.reset();
+	_file_.close();
+}
+
+
+//===============================================
+// class MemorySource                          ||
+//===============================================
+
+void MemorySource::stream(ByteSink sink)
+{
+	while(_pos_<_size_)
+	{
+		u32 chunk = ((_size_ - _pos_>0x80000000) ? 0x80000000 : _size_ - _pos_);
+
+		sink(&_data_[_pos_], chunk);
+		_pos_ += chunk;
+	}
+}
+
+
+//===============================================
+// class DecompressSource                      ||
+//===============================================
+
+void DecompressSource::stream(ByteSink sink)
+{
+	_source_->stream([this, &sink](const u8 *data, u32 size) {_decompressor_->feed(data, size, sink);});
+
+	if(!_decompressor_->finished())
+		throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Compressed CIA is truncated!");
+}
+
+
+//===============================================
+// class SocketSource                          ||
+//===============================================
+
+void SocketSource::stream(ByteSink sink)
+{
+	Buffer<u8> buf(SOCKET_BUF_SIZE, false);
+	ssize_t received;
+	u64 startTick;
+
+
+	while(_pos_<_size_)
+	{
+		startTick = svcGetSystemTick();
+		received = recv(_socket_, &buf, ((_size_ - _pos_>SOCKET_BUF_SIZE) ? SOCKET_BUF_SIZE : _size_ - _pos_), 0);
+		_readTicks_ += svcGetSystemTick() - startTick;
+
+		if(received<0 && errno == EINTR) continue;
+		if(received<0) throw fsException(_FILE_, __LINE__, errno, "Failed to receive data!");
+		if(!received) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Connection closed before all data was received!");
+
+		_pos_ += received;
+		sink(&buf, received);
+	}
+}
+
+
+std::unique_ptr<ByteSource> decompressIfNeeded(std::unique_ptr<ByteSource> source, const std::u16string& name)
+{
+	std::unique_ptr<Decompressor> decompressor(createDecompressor(name));
+
+	if(!decompressor) return source;
+	return std::unique_ptr<ByteSource>(new DecompressSource(std::move(source), std::move(decompressor)));
+}
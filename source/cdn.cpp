@@ -0,0 +1,194 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "bytesource.h"
+#include "cdn.h"
+#include "fs.h"
+#include "misc.h"
+#include "title.h"
+
+#define _FILE_ "cdn.cpp" // Replacement for __FILE__ without the path
+
+
+
+static std::vector<u8> readWholeFile(const std::u16string& path)
+{
+	fs::File f(path, FS_OPEN_READ);
+	std::vector<u8> data(f.size());
+
+
+	if(data.size() && f.read(&data[0], data.size()) != data.size()) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Failed to read file!");
+
+	return data;
+}
+
+
+CdnTitle::CdnTitle(const std::u16string& dir) : _dir_(dir)
+{
+	std::vector<u8> tmd = readWholeFile(dir + u"/tmd");
+	std::vector<u8> cetk = readWholeFile(dir + u"/cetk");
+	u32 tmdSigSize = 0, tikSigSize = 0, tmdSize, ticketSize, count, tmp;
+	u64 certOffset, ticketOffset, tmdOffset, contentOffset, contentSize = 0;
+
+
+
+	if(tmd.size()>=4) tmdSigSize = getSignatureSize(getBe32(&tmd[0]));
+	if(cetk.size()>=4) tikSigSize = getSignatureSize(getBe32(&cetk[0]));
+	if(!tmdSigSize || !tikSigSize || tmd.size()<tmdSigSize + TMD_HEADER_SIZE)
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid TMD or ticket!");
+
+	count = getBe16(&tmd[tmdSigSize + 0x9E]);
+	tmdSize = tmdSigSize + TMD_HEADER_SIZE + count * 0x30;
+	ticketSize = tikSigSize + TICKET_DATA_SIZE;
+
+	// The CDN appends the CP and CA certs to the TMD and the XS and CA certs to the ticket.
+	// That's all we need for the cert chain.
+	if(tmd.size()<tmdSize + CDN_CERT_CP_SIZE + CDN_CERT_CA_SIZE || cetk.size()<ticketSize + CDN_CERT_XS_SIZE)
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "The TMD or ticket has no certificates attached!");
+
+
+	certOffset    = CIA_ALIGN(CIA_HEADER_SIZE);
+	ticketOffset  = CIA_ALIGN(certOffset + CDN_CERT_CA_SIZE + CDN_CERT_XS_SIZE + CDN_CERT_CP_SIZE);
+	tmdOffset     = CIA_ALIGN(ticketOffset + ticketSize);
+	contentOffset = CIA_ALIGN(tmdOffset + tmdSize);
+	_head_.assign(contentOffset, 0);
+
+	for(u32 i=0; i<count; i++)
+	{
+		const u8 *chunk = &tmd[tmdSigSize + TMD_HEADER_SIZE + i * 0x30];
+		u16 index = getBe16(&chunk[4]);
+		Content content;
+
+		content.path = findContent(getBe32(chunk));
+		content.size = getBe64(&chunk[8]);
+		_contents_.push_back(content);
+
+		_head_[0x20 + index / 8] |= 0x80>>(index % 8); // Content index
+		contentSize += content.size;
+	}
+
+	// CIA header. Type, version and meta size stay 0.
+	tmp = CIA_HEADER_SIZE;
+	memcpy(&_head_[0x00], &tmp, 4);
+	tmp = CDN_CERT_CA_SIZE + CDN_CERT_XS_SIZE + CDN_CERT_CP_SIZE;
+	memcpy(&_head_[0x08], &tmp, 4);
+	memcpy(&_head_[0x0C], &ticketSize, 4);
+	memcpy(&_head_[0x10], &tmdSize, 4);
+	memcpy(&_head_[0x18], &contentSize, 8);
+
+	// Cert chain is CA, XS, CP
+	memcpy(&_head_[certOffset], &tmd[tmdSize + CDN_CERT_CP_SIZE], CDN_CERT_CA_SIZE);
+	memcpy(&_head_[certOffset + CDN_CERT_CA_SIZE], &cetk[ticketSize], CDN_CERT_XS_SIZE);
+	memcpy(&_head_[certOffset + CDN_CERT_CA_SIZE + CDN_CERT_XS_SIZE], &tmd[tmdSize], CDN_CERT_CP_SIZE);
+
+	memcpy(&_head_[ticketOffset], &cetk[0], ticketSize);
+	memcpy(&_head_[tmdOffset], &tmd[0], tmdSize);
+	_ciaSize_ = contentOffset + contentSize;
+
+
+	// Let the verifier pull the title infos out of the TMD we just placed
+	CiaVerifier verifier;
+	verifier.feed(&_head_[0], _head_.size());
+	verifier.getTitleEntry(_info_);
+}
+
+
+std::u16string CdnTitle::findContent(u32 contentID)
+{
+	static const char *formats[4] = {"%08lx.app", "%08lx", "%08lX.app", "%08lX"};
+	char name[16];
+
+
+	for(u32 i=0; i<4; i++)
+	{
+		snprintf(name, 16, formats[i], (unsigned long)contentID);
+		std::u16string path = _dir_ + u"/" + std::u16string(name, name + strlen(name));
+		if(fs::fileExist(path)) return path;
+	}
+
+	throw fsException(_FILE_, __LINE__, FS_ERR_DOESNT_EXIST, "Content file of CDN title is missing!");
+}
+
+
+//===============================================
+// class CdnTitle::Source                      ||
+//===============================================
+
+// Head from memory followed by every content read straight from its file
+class CdnTitle::Source : public ByteSource
+{
+	CdnTitle& _title_;
+	tuneKey _key_;
+	u64 _pos_ = 0, _readTicks_ = 0;
+
+
+public:
+	Source(CdnTitle& title, tuneKey key) : _title_(title), _key_(key) {}
+
+
+	void stream(ByteSink sink)
+	{
+		MemorySource head(&_title_._head_[0], _title_._head_.size());
+		head.stream(sink);
+		_pos_ = head.size();
+
+		for(auto& it : _title_._contents_)
+		{
+			FileSource content(it.path, _key_);
+			u64 left = it.size;
+
+			if(content.size()<it.size) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Content file of CDN title is too small!");
+
+			content.stream([&](const u8 *data, u32 size)
+			{
+				if(size>left) size = left; // Ignore padding at the end of the file
+				if(!size) return;
+
+				left -= size;
+				_pos_ += size;
+				sink(data, size);
+			});
+			_readTicks_ += content.readTicks();
+		}
+	}
+
+	u64 size() {return _title_._ciaSize_;}
+	u64 position() {return _pos_;}
+	u64 readTicks() {return _readTicks_;}
+};
+
+
+InstallStats CdnTitle::install(FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	Source source(*this, (mediaType == MEDIATYPE_NAND) ? TUNE_INSTALL_NAND : TUNE_INSTALL_SD);
+
+	return installCia(source, mediaType, _dir_, callback);
+}
+
+
+bool CdnTitle::isCdnDir(const std::u16string& dir)
+{
+	return fs::fileExist(dir + u"/tmd") && fs::fileExist(dir + u"/cetk");
+}
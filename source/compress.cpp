@@ -0,0 +1,278 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstring>
+#include <string>
+#include <3ds.h>
+#include "compress.h"
+#include "error.h"
+#include "fs.h"
+#include "title.h"
+
+#define _FILE_ "compress.cpp" // Replacement for __FILE__ without the path
+#define LZ4_FRAME_MAGIC     (0x184D2204)
+#define LZ4_SKIPPABLE_MAGIC (0x184D2A50) // Lower 4 bits are free
+#define LZ4_HISTORY_SIZE    (0x10000)    // 64 KB window for linked blocks
+
+
+
+static u32 getLe32(const u8 *p) {return p[0] | p[1]<<8 | p[2]<<16 | (u32)p[3]<<24;}
+
+
+//===============================================
+// class Lz4Decompressor                       ||
+//===============================================
+
+u32 Lz4Decompressor::decodeBlock(const u8 *src, u32 srcSize, u8 *dst)
+{
+	const u8 *ip = src, *const iend = src + srcSize;
+	u8 *op = dst, *const oend = dst + _maxBlockSize_;
+	const u8 *const lowest = &_out_[0]; // Matches may reach into the history
+	u32 len;
+
+
+	while(ip<iend)
+	{
+		const u8 token = *ip++;
+
+		// Literals
+		len = token>>4;
+		if(len == 15)
+		{
+			u8 b;
+			do
+			{
+				if(ip>=iend) goto corrupted;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		if(len>(u32)(iend - ip) || len>(u32)(oend - op)) goto corrupted;
+		memcpy(op, ip, len);
+		ip += len; op += len;
+		if(ip == iend) break; // The last sequence only has literals
+
+		// Match
+		if(iend - ip<2) goto corrupted;
+		const u32 offset = ip[0] | ip[1]<<8;
+		ip += 2;
+		if(!offset || offset>(u32)(op - lowest)) goto corrupted;
+
+		len = token & 15;
+		if(len == 15)
+		{
+			u8 b;
+			do
+			{
+				if(ip>=iend) goto corrupted;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		len += 4;
+		if(len>(u32)(oend - op)) goto corrupted;
+
+		// Byte by byte because source and destination may overlap
+		const u8 *match = op - offset;
+		while(len--) *op++ = *match++;
+	}
+
+	return op - dst;
+
+corrupted:
+	throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Corrupted LZ4 data!");
+}
+
+
+void Lz4Decompressor::step(std::function<void (const u8 *data, u32 size)>& out)
+{
+	u32 tmp;
+
+
+	_have_ = 0;
+	switch(_state_)
+	{
+		case LZ4_MAGIC:
+			tmp = getLe32(_hdr_);
+			if((tmp & 0xFFFFFFF0) == LZ4_SKIPPABLE_MAGIC) {_state_ = LZ4_SKIPPABLE_SIZE; _need_ = 4; break;}
+			if(tmp != LZ4_FRAME_MAGIC) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Not a LZ4 frame!");
+			_finished_ = false;
+			_state_ = LZ4_DESCRIPTOR;
+			_need_ = 2;
+			break;
+		case LZ4_DESCRIPTOR:
+			if((_hdr_[0] & 0xC0) != 0x40) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Unsupported LZ4 frame version!");
+			tmp = (_hdr_[1]>>4) & 7;
+			if(tmp<4) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Invalid LZ4 block size!");
+
+			_blockIndependent_ = _hdr_[0] & 0x20;
+			_blockChecksum_    = _hdr_[0] & 0x10;
+			_contentChecksum_  = _hdr_[0] & 0x04;
+			_maxBlockSize_     = 1u<<(8 + tmp * 2); // 64 KB, 256 KB, 1 MB or 4 MB
+			_in_.resize(_maxBlockSize_ + 4);
+			_out_.resize(LZ4_HISTORY_SIZE + _maxBlockSize_);
+			_histLen_ = 0;
+
+			// Content size, dictionary ID and header checksum. We need none of them.
+			_need_ = ((_hdr_[0] & 0x08) ? 8 : 0) + ((_hdr_[0] & 0x01) ? 4 : 0) + 1;
+			_state_ = LZ4_DESCRIPTOR_REST;
+			break;
+		case LZ4_DESCRIPTOR_REST:
+			_state_ = LZ4_BLOCK_SIZE;
+			_need_ = 4;
+			break;
+		case LZ4_BLOCK_SIZE:
+			tmp = getLe32(_hdr_);
+			if(!tmp) // End mark
+			{
+				if(_contentChecksum_) {_state_ = LZ4_CONTENT_CHECKSUM; _need_ = 4;}
+				else {_state_ = LZ4_MAGIC; _need_ = 4; _finished_ = true;}
+				break;
+			}
+			_uncompressedBlock_ = tmp>>31;
+			tmp &= 0x7FFFFFFF;
+			if(tmp>_maxBlockSize_) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "LZ4 block too big!");
+			_need_ = tmp + (_blockChecksum_ ? 4 : 0);
+			_state_ = LZ4_BLOCK_DATA;
+			break;
+		case LZ4_BLOCK_DATA:
+		{
+			u8 *dst = &_out_[_histLen_];
+			u32 blockSize = _need_ - (_blockChecksum_ ? 4 : 0);
+
+			if(_uncompressedBlock_) memcpy(dst, &_in_[0], blockSize);
+			else blockSize = decodeBlock(&_in_[0], blockSize, dst);
+			if(blockSize) out(dst, blockSize);
+
+			// Keep the last 64 KB around for the next block
+			if(!_blockIndependent_)
+			{
+				tmp = _histLen_ + blockSize;
+				_histLen_ = ((tmp<LZ4_HISTORY_SIZE) ? tmp : LZ4_HISTORY_SIZE);
+				memmove(&_out_[0], &_out_[tmp - _histLen_], _histLen_);
+			}
+
+			_state_ = LZ4_BLOCK_SIZE;
+			_need_ = 4;
+			break;
+		}
+		case LZ4_CONTENT_CHECKSUM:
+			_state_ = LZ4_MAGIC;
+			_need_ = 4;
+			_finished_ = true;
+			break;
+		case LZ4_SKIPPABLE_SIZE:
+			_need_ = getLe32(_hdr_);
+			_state_ = LZ4_SKIPPABLE_DATA;
+			if(_need_) break;
+			// Fall through for empty skippable frames
+		case LZ4_SKIPPABLE_DATA:
+			_state_ = LZ4_MAGIC;
+			_need_ = 4;
+	}
+}
+
+
+void Lz4Decompressor::feed(const u8 *data, u32 size, std::function<void (const u8 *data, u32 size)> out)
+{
+	u32 n;
+
+
+	while(size)
+	{
+		n = ((_need_ - _have_<size) ? _need_ - _have_ : size);
+
+		// Block data goes to the input buffer, skippable frames go nowhere
+		if(_state_ == LZ4_BLOCK_DATA) memcpy(&_in_[_have_], data, n);
+		else if(_state_ != LZ4_SKIPPABLE_DATA) memcpy(&_hdr_[_have_], data, n);
+
+		_have_ += n;
+		data += n;
+		size -= n;
+		if(_have_ == _need_) step(out);
+	}
+}
+
+
+//===============================================
+// class ZstdDecompressor                      ||
+//===============================================
+
+#ifdef WITH_ZSTD
+ZstdDecompressor::ZstdDecompressor()
+{
+	_stream_ = ZSTD_createDStream();
+	if(!_stream_) throw titleException(_FILE_, __LINE__, ERR_NOT_ENOUGH_MEM, "Failed to create zstd stream!");
+	ZSTD_initDStream(_stream_);
+	_out_.resize(ZSTD_DStreamOutSize());
+}
+
+
+void ZstdDecompressor::feed(const u8 *data, u32 size, std::function<void (const u8 *data, u32 size)> out)
+{
+	ZSTD_inBuffer input = {data, size, 0};
+	ZSTD_outBuffer output;
+	size_t res;
+
+
+	do
+	{
+		output = {&_out_[0], _out_.size(), 0};
+		res = ZSTD_decompressStream(_stream_, &output, &input);
+		if(ZSTD_isError(res)) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, ZSTD_getErrorName(res));
+
+		if(output.pos) out(&_out_[0], output.pos);
+		_finished_ = !res;
+	} while(input.pos<input.size || output.pos == output.size);
+}
+#endif
+
+
+//===============================================
+// Misc functions                              ||
+//===============================================
+
+// Ignores A-Z case like the file listing does
+static bool hasSuffix(const std::u16string& path, const std::u16string& suffix)
+{
+	return fs::NameFilter(suffix).match(path, false);
+}
+
+
+Decompressor* createDecompressor(const std::u16string& path)
+{
+	if(hasSuffix(path, u".lz4")) return new Lz4Decompressor;
+	if(hasSuffix(path, u".zst"))
+	{
+#ifdef WITH_ZSTD
+		return new ZstdDecompressor;
+#else
+		throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "This build has no zstd support!");
+#endif
+	}
+
+	return nullptr;
+}
+
+
+bool isCompressed(const std::u16string& path)
+{
+	return hasSuffix(path, u".lz4") || hasSuffix(path, u".zst");
+}
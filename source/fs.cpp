@@ -19,12 +19,15 @@
 
 #include <algorithm>
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
+#include <cstring>
 #include <ctime>
 #include <3ds.h>
 #include "fs.h"
 #include "misc.h"
+#include "sha256.h"
 //#include "zip.h"
 //#include "unzip.h"
 
@@ -37,17 +40,477 @@ FS_Archive sdmcArchive;
 
 namespace fs
 {
-	// Simple std::sort() compar function for file names
-	bool fileNameCmp(fs::DirEntry& first, fs::DirEntry& second)
+	static inline u16 foldCase(u16 c)
 	{
-		if(first.isDir && (!second.isDir)) return true;
-		else if((!first.isDir) && second.isDir) return false;
+		return ((c >= u'A' && c <= u'Z') ? c + (u'a' - u'A') : c);
+	}
+
+
+	//===============================================
+	// class DirCache                              ||
+	//===============================================
+	// Listings and what is known about single paths per archive. Filled by
+	// listDirContents(), fileExist(), dirExist(), File::open() and
+	// File::size(). Every call in here that changes the FS invalidates what
+	// it touched. Paths are stored with A-Z folded like the FS compares them.
+	// Changes by other processes are only seen after clearDirCache().
+	class DirCache
+	{
+		typedef std::pair<FS_Archive, std::u16string> Key;
+
+		enum
+		{
+			STAT_FILE     = 1,
+			STAT_DIR      = 2,
+			STAT_NOT_FILE = 4, // Known negative results. A file or dir may
+			STAT_NOT_DIR  = 8  // still exist where the other type is missing.
+		};
+
+		struct Stat
+		{
+			u8  flags = 0;
+			u64 size = U64_MAX; // Files only. U64_MAX means unknown.
+		};
+
+		std::map<Key, std::vector<DirEntry>> _listings_; // Sorted like listDirContents()
+		std::map<Key, Stat> _stats_;
+		size_t _entryCount_ = 0;
+		Mutex _lock_;
+
+		static Key makeKey(FS_Archive archive, const std::u16string& path);
+		static std::u16string entryName(const std::u16string& path); // Last path component in its original case
+		void eraseListing(std::map<Key, std::vector<DirEntry>>::iterator it);
+		bool makeRoomLocked(size_t count, bool newListing);
+		void changedLocked(const Key& key);
+		Stat& statLocked(const Key& key);
+		DirEntry* findInParentLocked(const Key& key);
+
+
+	public:
+		bool getListing(FS_Archive archive, const std::u16string& path, std::vector<DirEntry>& entries);
+		void putListing(FS_Archive archive, const std::u16string& path, const std::vector<DirEntry>& entries);
+		int  exists(FS_Archive archive, const std::u16string& path, bool isDir); // 1 yes, 0 no, -1 unknown
+		bool fileSize(FS_Archive archive, const std::u16string& path, u64& size);
+		void found(FS_Archive archive, const std::u16string& path, bool isDir, u64 size=U64_MAX);
+		void notFound(FS_Archive archive, const std::u16string& path, bool isDir);
+		void dirMade(FS_Archive archive, const std::u16string& path);
+		void fileWritten(FS_Archive archive, const std::u16string& path); // Exists now, size unknown
+		void changed(FS_Archive archive, const std::u16string& path); // Something at path was created, written or deleted
+		void removeTree(FS_Archive archive, const std::u16string& path); // path and everything below is gone
+		void clear();
+	};
+
+	static DirCache dirCache;
+
+
+	// "/a/b/" is the same dir as "/a/b"
+	DirCache::Key DirCache::makeKey(FS_Archive archive, const std::u16string& path)
+	{
+		Key key(archive, path);
+		for(auto& it : key.second) it = foldCase(it);
+		while(key.second.length() > 1 && key.second.back() == u'/') key.second.pop_back();
+
+		return key;
+	}
+
+
+	std::u16string DirCache::entryName(const std::u16string& path)
+	{
+		const size_t end = path.find_last_not_of(u'/') + 1; // 0 for the root
+		if(!end) return u"";
+
+		const size_t start = path.find_last_of(u'/', end - 1) + 1; // 0 without a slash
+		return path.substr(start, end - start);
+	}
+
+
+	void DirCache::eraseListing(std::map<Key, std::vector<DirEntry>>::iterator it)
+	{
+		_entryCount_ -= it->second.size();
+		_listings_.erase(it);
+	}
+
+
+	// Returns false if count entries never fit
+	bool DirCache::makeRoomLocked(size_t count, bool newListing)
+	{
+		if(count > DIR_CACHE_MAX_ENTRIES) return false;
+
+		// Simply start over. Walks list every dir once anyway. Empty listings
+		// of new dirs hold no entries so their number is capped the same way.
+		if(_entryCount_ + count > DIR_CACHE_MAX_ENTRIES || (newListing && _listings_.size() >= DIR_CACHE_MAX_ENTRIES))
+		{
+			_listings_.clear();
+			_entryCount_ = 0;
+		}
+
+		return true;
+	}
+
+
+	// What we knew about key and the listing of its parent doesn't match anymore
+	void DirCache::changedLocked(const Key& key)
+	{
+		Key parent(key);
+		removeFromPath(parent.second);
+
+		auto it = _listings_.find(parent);
+		if(it != _listings_.end()) eraseListing(it);
+		_stats_.erase(key);
+	}
+
+
+	DirCache::Stat& DirCache::statLocked(const Key& key)
+	{
+		// Like the listings simply start over when full
+		if(_stats_.size() >= STAT_CACHE_MAX_ENTRIES && !_stats_.count(key)) _stats_.clear();
+
+		return _stats_[key];
+	}
+
+
+	DirEntry* DirCache::findInParentLocked(const Key& key)
+	{
+		Key parent(key);
+		removeFromPath(parent.second);
+		auto it = _listings_.find(parent);
+		if(it == _listings_.end()) return nullptr;
+
+		const std::u16string name = key.second.substr(key.second.find_last_of(u'/') + 1);
+		for(auto& entry : it->second)
+		{
+			if(entry.name.length() != name.length()) continue;
+
+			size_t i = 0;
+			while(i < name.length() && foldCase(entry.name[i]) == name[i]) i++;
+			if(i == name.length()) return &entry;
+		}
+
+		return nullptr;
+	}
+
+
+	bool DirCache::getListing(FS_Archive archive, const std::u16string& path, std::vector<DirEntry>& entries)
+	{
+		LockGuard lock(_lock_);
+
+		auto it = _listings_.find(makeKey(archive, path));
+		if(it == _listings_.end()) return false;
+
+		// Files written since the listing need a new one for their size
+		for(auto& entry : it->second) if(entry.size == U64_MAX) return false;
+
+		entries = it->second;
+		return true;
+	}
+
+
+	void DirCache::putListing(FS_Archive archive, const std::u16string& path, const std::vector<DirEntry>& entries)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+
+
+		if(!makeRoomLocked(entries.size(), true)) return;
+
+		auto it = _listings_.find(key);
+		if(it != _listings_.end()) eraseListing(it);
+
+		_listings_[key] = entries;
+		_entryCount_ += entries.size();
+		statLocked(key).flags = STAT_DIR | STAT_NOT_FILE;
+	}
+
+
+	int DirCache::exists(FS_Archive archive, const std::u16string& path, bool isDir)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+
+
+		if(key.second.empty()) return -1; // Let the FS decide
+		if(isDir && (key.second == u"/" || _listings_.count(key))) return 1;
+
+		auto it = _stats_.find(key);
+		if(it != _stats_.end())
+		{
+			const u8 flags = it->second.flags;
+
+			if(flags & (isDir ? STAT_DIR : STAT_FILE)) return 1;
+			if(flags & (isDir ? STAT_NOT_DIR | STAT_FILE : STAT_NOT_FILE | STAT_DIR)) return 0;
+		}
+
+		// Without a listing of the parent we don't know
+		Key parent(key);
+		removeFromPath(parent.second);
+		if(!_listings_.count(parent)) return -1;
+
+		const DirEntry *entry = findInParentLocked(key);
+		return entry && entry->isDir == isDir;
+	}
+
+
+	bool DirCache::fileSize(FS_Archive archive, const std::u16string& path, u64& size)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+
+
+		auto it = _stats_.find(key);
+		if(it != _stats_.end() && (it->second.flags & STAT_FILE) && it->second.size != U64_MAX)
+		{
+			size = it->second.size;
+			return true;
+		}
+
+		const DirEntry *entry = findInParentLocked(key);
+		if(!entry || entry->isDir || entry->size == U64_MAX) return false;
+
+		size = entry->size;
+		return true;
+	}
+
+
+	void DirCache::found(FS_Archive archive, const std::u16string& path, bool isDir, u64 size)
+	{
+		LockGuard lock(_lock_);
+		Stat& stat = statLocked(makeKey(archive, path));
+
+		stat.flags = (isDir ? STAT_DIR | STAT_NOT_FILE : STAT_FILE | STAT_NOT_DIR);
+		stat.size = size;
+	}
+
+
+	void DirCache::notFound(FS_Archive archive, const std::u16string& path, bool isDir)
+	{
+		LockGuard lock(_lock_);
+
+		statLocked(makeKey(archive, path)).flags |= (isDir ? STAT_NOT_DIR : STAT_NOT_FILE);
+	}
+
+
+	// Unlike changed() this keeps the listing of the parent. makePath() then
+	// knows the siblings it makes next don't exist yet.
+	void DirCache::dirMade(FS_Archive archive, const std::u16string& path)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+		Key parent(key);
+
+
+		makeRoomLocked(1, true); // Entry in the parent and the empty listing
+		removeFromPath(parent.second);
+		auto it = _listings_.find(parent);
+		if(it != _listings_.end() && !findInParentLocked(key))
+		{
+			it->second.push_back(DirEntry(entryName(path), true, 0));
+			sortDirEntries(it->second);
+			_entryCount_++;
+		}
+		else if(it != _listings_.end()) eraseListing(it);
+
+		statLocked(key).flags = STAT_DIR | STAT_NOT_FILE;
+		_listings_[key]; // New dirs are empty
+	}
+
+
+	// Keeps the listing of the parent for existence checks. Only the size of
+	// the file is unknown there.
+	void DirCache::fileWritten(FS_Archive archive, const std::u16string& path)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+		Key parent(key);
+		DirEntry *entry;
+
+
+		makeRoomLocked(1, false);
+		entry = findInParentLocked(key);
+		removeFromPath(parent.second);
+		auto it = _listings_.find(parent);
+		if(entry && !entry->isDir) entry->size = U64_MAX;
+		else if(entry) eraseListing(it);
+		else if(it != _listings_.end())
+		{
+			it->second.push_back(DirEntry(entryName(path), false, U64_MAX));
+			sortDirEntries(it->second);
+			_entryCount_++;
+		}
+
+		Stat& stat = statLocked(key);
+		stat.flags = STAT_FILE | STAT_NOT_DIR;
+		stat.size = U64_MAX;
+	}
+
+
+	void DirCache::changed(FS_Archive archive, const std::u16string& path)
+	{
+		LockGuard lock(_lock_);
+
+		changedLocked(makeKey(archive, path));
+	}
+
+
+	void DirCache::removeTree(FS_Archive archive, const std::u16string& path)
+	{
+		LockGuard lock(_lock_);
+		const Key key = makeKey(archive, path);
+
+
+		// Everything below path follows path directly in both containers
+		auto isBelow = [&](const Key& other)
+		{
+			if(other.first != key.first || other.second.compare(0, key.second.length(), key.second)) return false;
+			return other.second.length() == key.second.length() || key.second == u"/" || other.second[key.second.length()] == u'/';
+		};
+
+		for(auto it = _listings_.lower_bound(key); it != _listings_.end() && it->first.first == key.first
+				&& !it->first.second.compare(0, key.second.length(), key.second);)
+		{
+			if(isBelow(it->first)) eraseListing(it++);
+			else it++;
+		}
+		for(auto it = _stats_.lower_bound(key); it != _stats_.end() && it->first.first == key.first
+				&& !it->first.second.compare(0, key.second.length(), key.second);)
+		{
+			if(isBelow(it->first)) _stats_.erase(it++);
+			else it++;
+		}
+
+		if(key.second != u"/") changedLocked(key);
+	}
+
+
+	void DirCache::clear()
+	{
+		LockGuard lock(_lock_);
+
+		_listings_.clear();
+		_stats_.clear();
+		_entryCount_ = 0;
+	}
+
+
+
+	//===============================================
+	// class IoRequest                             ||
+	//===============================================
+
+	// Runs the async requests of all files on one thread in order.
+	// The thread is started by the first request.
+	class IoWorker
+	{
+		std::deque<IoHandle> _queue_;
+		Mutex _lock_;
+		Semaphore _queued_;
+		std::unique_ptr<WorkerThread> _thread_;
+		bool _noThread_ = false;
+
+		static void run(IoRequest& req);
+		void workerFunc();
+
+
+	public:
+		IoWorker() : _queued_(0, 0x7FFFFFFF) {}
+		~IoWorker();
+
+
+		void submit(const IoHandle& req);
+		void fence(); // Waits for all requests submitted so far
+	};
+
+	static IoWorker ioWorker;
+
+
+	IoWorker::~IoWorker()
+	{
+		_queued_.release();
+		_thread_.reset(); // Joins it
+	}
+
+
+	void IoWorker::run(IoRequest& req)
+	{
+		if(req._fileHandle_)
+		{
+			if(req._write_) req._res_ = FSFILE_Write(req._fileHandle_, &req._transferred_, req._offset_, req._buf_, req._size_, req._flags_);
+			else req._res_ = FSFILE_Read(req._fileHandle_, &req._transferred_, req._offset_, req._buf_, req._size_);
+		}
+
+		req._done_ = true;
+		req._signal_.release();
+	}
+
+
+	void IoWorker::workerFunc()
+	{
+		IoHandle req;
+
+
+		while(1)
+		{
+			_queued_.acquire();
+
+			{
+				LockGuard lock(_lock_);
+				if(_queue_.empty()) return; // Only the destructor releases without a request
+				req = std::move(_queue_.front());
+				_queue_.pop_front();
+			}
+
+			run(*req);
+			req.reset();
+		}
+	}
+
+
+	void IoWorker::submit(const IoHandle& req)
+	{
+		{
+			LockGuard lock(_lock_);
+
+			if(!_thread_ && !_noThread_)
+			{
+				_thread_.reset(new WorkerThread([this]() {workerFunc();}));
+				_noThread_ = !_thread_->started();
+			}
+
+			if(!_noThread_)
+			{
+				_queue_.push_back(req);
+				_queued_.release();
+				return;
+			}
+		}
+
+		run(*req); // No thread. Do it now.
+	}
+
+
+	void IoWorker::fence()
+	{
+		IoHandle req(new IoRequest(0, nullptr, 0, 0, false));
+
+
+		submit(req);
+		req->wait();
+	}
 
 
-		return (first.name.compare(second.name)<0);
+	u32 IoRequest::wait()
+	{
+		if(!_waited_)
+		{
+			_signal_.acquire();
+			_waited_ = true;
+		}
+
+		if(_res_) throw fsException(_FILE_, __LINE__, _res_, (_write_ ? "Failed to write to file!" : "Failed to read from file!"));
+		return _transferred_;
 	}
 
 
+
 	//===============================================
 	// class File                                  ||
 	//===============================================
@@ -57,6 +520,8 @@ namespace fs
 		FS_Path filePath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
 		Result  res;
 
+		close(); // Close file handle before we open a new one
+
 		// Save args for when we want to move the file or other uses
 		_path_      = path;
 		_openFlags_ = openFlags;
@@ -64,13 +529,14 @@ namespace fs
 
 
 
-		close(); // Close file handle before we open a new one
 		seek(0, FS_SEEK_SET); // Reset current offset
 		if(FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags & 3, 0))
 		{
 			if((res = FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags, 0)))
 				throw fsException(_FILE_, __LINE__, res, "Failed to open file!");
 		}
+		if(openFlags & (FS_OPEN_WRITE | FS_OPEN_CREATE)) dirCache.fileWritten(archive, path);
+		else dirCache.found(archive, path, false);
 	}
 
 
@@ -80,7 +546,12 @@ namespace fs
 
 
 		close(); // Close file handle before we open a new one
+		_path_.clear();
+		_openFlags_ = openFlags;
+		_archive_   = &archive;
+
 		seek(0, FS_SEEK_SET); // Reset current offset
+		if(openFlags & (FS_OPEN_WRITE | FS_OPEN_CREATE)) dirCache.clear(); // No idea where this is
 		if(FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags & 3, 0))
 		{
 			if((res = FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags, 0)))
@@ -89,6 +560,27 @@ namespace fs
 	}
 
 
+	void File::close()
+	{
+		if(!_fileHandle_) return;
+
+		if(_asyncUsed_) ioWorker.fence();
+		_asyncUsed_ = false;
+
+		try
+		{
+			writeCombined();
+			if(_flushPolicy_ == FS_FLUSH_ON_CLOSE || (_flushPolicy_ == FS_FLUSH_EVERY_N && _unflushed_)) FSFILE_Flush(_fileHandle_);
+		} catch(fsException& e) {} // Nobody to tell. Use flush() to see errors.
+		_combineFill_ = 0;
+		_unflushed_ = 0;
+
+		FSFILE_Close(_fileHandle_);
+		_fileHandle_ = 0;
+		if((_openFlags_ & FS_OPEN_WRITE) && !_path_.empty()) dirCache.fileWritten(*_archive_, _path_); // The size may have changed
+	}
+
+
 	u32 File::read(void *buf, u32 size)
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
@@ -97,6 +589,8 @@ namespace fs
 		Result res;
 
 
+		writeCombined(); // Read what was written
+
 		if((res = FSFILE_Read(_fileHandle_, &bytesRead, _offset_, buf, size)))
 			throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
 
@@ -105,71 +599,179 @@ namespace fs
 	}
 
 
-	u32 File::write(const void *buf, u32 size)
+	u32 File::writeRaw(const void *buf, u32 size, u64 offset)
 	{
-		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
-
 		u32 bytesWritten;
 		Result res;
 
 
-		if((res = FSFILE_Write(_fileHandle_, &bytesWritten, _offset_, buf, size, FS_WRITE_FLUSH)))
+		if((res = FSFILE_Write(_fileHandle_, &bytesWritten, offset, buf, size, (_flushPolicy_ == FS_FLUSH_ALWAYS ? FS_WRITE_FLUSH : 0))))
 			throw fsException(_FILE_, __LINE__, res, "Failed to write to file!");
 
-		_offset_ += bytesWritten;
+		if(_flushPolicy_ == FS_FLUSH_EVERY_N && (_unflushed_ += bytesWritten) >= _flushInterval_)
+		{
+			if((res = FSFILE_Flush(_fileHandle_))) throw fsException(_FILE_, __LINE__, res, "Failed to flush file!");
+			_unflushed_ = 0;
+		}
+
 		return bytesWritten;
 	}
 
 
-	void File::flush()
+	void File::writeCombined()
+	{
+		if(!_combineFill_) return;
+
+		u32 fill = _combineFill_;
+		_combineFill_ = 0; // Don't retry a failed write on close
+		writeRaw(_combine_.get(), fill, _combineOffset_);
+	}
+
+
+	u32 File::write(const void *buf, u32 size)
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
-    Result res;
+		const u8 *in = (const u8*)buf;
+		u32 left = size, chunk, room;
 
 
-		if((res = FSFILE_Flush(_fileHandle_))) throw fsException(_FILE_, __LINE__, res, "Failed to flush file!");
-	}
+		if(!_combineSize_)
+		{
+			chunk = writeRaw(buf, size, _offset_);
+			_offset_ += chunk;
+			return chunk;
+		}
 
+		// Only appends to the collected data
+		if(_combineFill_ && _offset_ != _combineOffset_ + _combineFill_) writeCombined();
 
-	void File::seek(const u64 offset, fsSeekMode mode)
-	{
-		switch(mode)
+		while(left)
 		{
-			case FS_SEEK_SET:
-				_offset_ = offset;
-				break;
-			case FS_SEEK_CUR:
-				_offset_ += offset;
-				break;
-			case FS_SEEK_END:
-				_offset_ = size() - offset;
+			if(!_combineFill_ && !(_offset_ % _combineSize_) && left >= _combineSize_)
+			{
+				chunk = writeRaw(in, left - left % _combineSize_, _offset_);
+			}
+			else
+			{
+				if(!_combineFill_) _combineOffset_ = _offset_;
+
+				// Up to the next multiple of _combineSize_
+				room = _combineSize_ - (_combineOffset_ + _combineFill_) % _combineSize_;
+				chunk = std::min(left, room);
+				memcpy(&_combine_[_combineFill_], in, chunk);
+				_combineFill_ += chunk;
+				if(chunk == room) writeCombined();
+			}
+
+			in += chunk;
+			left -= chunk;
+			_offset_ += chunk;
 		}
+
+		return size;
 	}
 
 
-	u64 File::size()
+	void File::flush()
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
-		u64 tmp;
 		Result res;
 
 
-		if((res = FSFILE_GetSize(_fileHandle_, &tmp))) throw fsException(_FILE_, __LINE__, res, "Failed to get file size!");
-
-		return tmp;
+		writeCombined();
+		if(_asyncUsed_) ioWorker.fence();
+		if((res = FSFILE_Flush(_fileHandle_))) throw fsException(_FILE_, __LINE__, res, "Failed to flush file!");
+		_unflushed_ = 0;
 	}
 
 
-	void File::setSize(const u64 size)
+	IoHandle File::readAsync(void *buf, u32 size, u64 offset)
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
-		Result res;
+		IoHandle req(new IoRequest(_fileHandle_, buf, size, offset, false));
 
 
-		if((res = FSFILE_SetSize(_fileHandle_, size))) throw fsException(_FILE_, __LINE__, res, "Failed to set file size!");
+		writeCombined(); // Read what was written
+		_asyncUsed_ = true;
+		ioWorker.submit(req);
+		return req;
+	}
+
+
+	// Only FS_FLUSH_ALWAYS flushes right away. Otherwise flush() and close() do.
+	IoHandle File::writeAsync(const void *buf, u32 size, u64 offset)
+	{
+		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+
+		IoHandle req(new IoRequest(_fileHandle_, (void*)buf, size, offset, true, (_flushPolicy_ == FS_FLUSH_ALWAYS ? FS_WRITE_FLUSH : 0)));
+
+
+		writeCombined(); // Keep the order of writes
+		_asyncUsed_ = true;
+		if(_flushPolicy_ == FS_FLUSH_EVERY_N) _unflushed_ += size;
+		ioWorker.submit(req);
+		return req;
+	}
+
+
+	void File::setWriteMode(fsFlushPolicy policy, u32 combineSize, u32 flushInterval)
+	{
+		if(_fileHandle_) writeCombined();
+
+		_flushPolicy_ = policy;
+		_flushInterval_ = flushInterval;
+		_combineSize_ = combineSize;
+		_combine_.reset(combineSize ? new u8[combineSize] : nullptr);
+	}
+
+
+	void File::seek(const u64 offset, fsSeekMode mode)
+	{
+		switch(mode)
+		{
+			case FS_SEEK_SET:
+				_offset_ = offset;
+				break;
+			case FS_SEEK_CUR:
+				_offset_ += offset;
+				break;
+			case FS_SEEK_END:
+				_offset_ = size() - offset;
+		}
+	}
+
+
+	u64 File::size()
+	{
+		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+
+		const bool cacheable = !(_openFlags_ & FS_OPEN_WRITE) && !_path_.empty(); // Writers change the size
+		u64 tmp;
+		Result res;
+
+
+		if(cacheable && dirCache.fileSize(*_archive_, _path_, tmp)) return tmp;
+
+		writeCombined();
+		if((res = FSFILE_GetSize(_fileHandle_, &tmp))) throw fsException(_FILE_, __LINE__, res, "Failed to get file size!");
+		if(cacheable) dirCache.found(*_archive_, _path_, false, tmp);
+
+		return tmp;
+	}
+
+
+	void File::setSize(const u64 size)
+	{
+		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+
+		Result res;
+
+
+		writeCombined();
+		if((res = FSFILE_SetSize(_fileHandle_, size))) throw fsException(_FILE_, __LINE__, res, "Failed to set file size!");
 	}
 
 
@@ -200,87 +802,1078 @@ namespace fs
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
-		close(); // Close file handle before we can delete this file
-		deleteFile(_path_, *_archive_);
+		close(); // Close file handle before we can delete this file
+		deleteFile(_path_, *_archive_);
+	}
+
+
+	//===============================================
+	// class BufferedFile                          ||
+	//===============================================
+
+	void BufferedFile::open(const std::u16string& path, u32 openFlags, FS_Archive& archive)
+	{
+		_file_.open(path, openFlags, archive);
+		if(!_window_) _window_.reset(new u8[_windowSize_]);
+
+		_windowFill_ = 0;
+		_offset_ = 0;
+		_sizeKnown_ = false;
+		if(!(openFlags & FS_OPEN_WRITE))
+		{
+			_size_ = _file_.size();
+			_sizeKnown_ = true;
+		}
+	}
+
+
+	void BufferedFile::close()
+	{
+		_file_.close();
+		_windowFill_ = 0;
+	}
+
+
+	u32 BufferedFile::read(void *buf, u32 size)
+	{
+		u8 *out = (u8*)buf;
+		u32 done = 0, chunk;
+		u64 start;
+
+
+		while(size)
+		{
+			// Hit
+			if(_offset_ >= _windowOffset_ && _offset_ < _windowOffset_ + _windowFill_)
+			{
+				chunk = std::min<u64>(size, _windowOffset_ + _windowFill_ - _offset_);
+				memcpy(out, &_window_[_offset_ - _windowOffset_], chunk);
+
+				out += chunk;
+				done += chunk;
+				size -= chunk;
+				_offset_ += chunk;
+				continue;
+			}
+
+			if(size >= _windowSize_)
+			{
+				_file_.seek(_offset_, FS_SEEK_SET);
+				chunk = _file_.read(out, size);
+				_offset_ += chunk;
+				return done + chunk;
+			}
+
+			// Going backwards. Let the new window end where the rest of this read ends.
+			if(_offset_ < _windowOffset_ && _offset_ + size < _windowSize_) start = 0;
+			else if(_offset_ < _windowOffset_) start = _offset_ + size - _windowSize_;
+			else start = _offset_;
+
+			_file_.seek(start, FS_SEEK_SET);
+			_windowFill_ = _file_.read(_window_.get(), _windowSize_);
+			_windowOffset_ = start;
+			if(_offset_ >= _windowOffset_ + _windowFill_) break; // End of file
+		}
+
+		return done;
+	}
+
+
+	u32 BufferedFile::write(const void *buf, u32 size)
+	{
+		u32 written;
+
+
+		_windowFill_ = 0;
+		_file_.seek(_offset_, FS_SEEK_SET);
+		written = _file_.write(buf, size);
+		_offset_ += written;
+
+		return written;
+	}
+
+
+	// Same semantics as File::seek()
+	void BufferedFile::seek(const u64 offset, fsSeekMode mode)
+	{
+		switch(mode)
+		{
+			case FS_SEEK_SET:
+				_offset_ = offset;
+				break;
+			case FS_SEEK_CUR:
+				_offset_ += offset;
+				break;
+			case FS_SEEK_END:
+				_offset_ = size() - offset;
+		}
+	}
+
+
+	u64 BufferedFile::size()
+	{
+		return (_sizeKnown_ ? _size_ : _file_.size());
+	}
+
+
+
+	//===============================================
+	// class BlockSizeTuner                        ||
+	//===============================================
+
+	u32 BlockSizeTuner::_tunedSizes_[2][TUNE_KEY_COUNT] = {{0}};
+	u8  BlockSizeTuner::_console_ = 0xFF;
+	Mutex BlockSizeTuner::_lock_;
+
+
+	BlockSizeTuner::BlockSizeTuner(tuneKey key, u64 transferSize, u32 bufferCount, bool probe) : _key_(key)
+	{
+		u64 probeBytes = 0;
+		u32 tuned;
+
+
+		{
+			LockGuard lock(_lock_);
+			load();
+			tuned = _tunedSizes_[_console_][_key_];
+		}
+
+		_maxBlockSize_ = TUNE_MAX_BLOCK;
+		while(_maxBlockSize_>TUNE_MIN_BLOCK && (u64)_maxBlockSize_ * bufferCount>TUNE_MEM_CAP) _maxBlockSize_ >>= 1;
+
+		if(tuned) _best_ = ((tuned<_maxBlockSize_) ? tuned : _maxBlockSize_);
+		else
+		{
+			_best_ = ((MAX_BUF_SIZE<_maxBlockSize_) ? MAX_BUF_SIZE : _maxBlockSize_);
+
+			for(u32 size=TUNE_MIN_BLOCK; size<=_maxBlockSize_ && _candidateCount_<8; size <<= 1)
+			{
+				_candidates_[_candidateCount_] = size;
+				_ticks_[_candidateCount_++] = 0;
+				probeBytes += size * TUNE_PROBE_BLOCKS;
+			}
+
+			// Only probe if the transfer is big enough to try every candidate
+			_probing_ = (probe && probeBytes + TUNE_MIN_BLOCK <= transferSize);
+		}
+
+		// Only probing needs buffers for the biggest candidate. Small transfers don't need big buffers either.
+		if(!_probing_)
+		{
+			while(_maxBlockSize_>TUNE_MIN_BLOCK && (_maxBlockSize_>>1)>=transferSize) _maxBlockSize_ >>= 1;
+			if(_best_>_maxBlockSize_) _best_ = _maxBlockSize_;
+			_maxBlockSize_ = _best_;
+		}
+
+		_lastTick_ = svcGetSystemTick();
+	}
+
+
+	u32 BlockSizeTuner::sizeFor(u32 blockIndex)
+	{
+		if(_probing_)
+		{
+			// Block 0 fills the pipeline and isn't measured
+			if(!blockIndex) return _candidates_[0];
+			if((blockIndex - 1) / TUNE_PROBE_BLOCKS < _candidateCount_) return _candidates_[(blockIndex - 1) / TUNE_PROBE_BLOCKS];
+		}
+
+		return _best_;
+	}
+
+
+	void BlockSizeTuner::record(u32 blockSize)
+	{
+		u64 now = svcGetSystemTick();
+		u64 ticks = now - _lastTick_;
+		u32 candidate;
+
+
+		_lastTick_ = now;
+		if(!_probing_ || !_recorded_++) return;
+
+		candidate = (_recorded_ - 2) / TUNE_PROBE_BLOCKS;
+		if(candidate<_candidateCount_) _ticks_[candidate] += ticks;
+
+		if(_recorded_ == 1 + _candidateCount_ * TUNE_PROBE_BLOCKS)
+		{
+			u32 best = 0;
+
+			// Compare bytes per tick without dividing
+			for(u32 i=1; i<_candidateCount_; i++)
+			{
+				if((u64)_candidates_[i] * _ticks_[best] > (u64)_candidates_[best] * _ticks_[i]) best = i;
+			}
+
+			_best_ = _candidates_[best];
+			_probing_ = false;
+
+			LockGuard lock(_lock_);
+			_tunedSizes_[_console_][_key_] = _best_;
+			save();
+		}
+	}
+
+
+	void BlockSizeTuner::load()
+	{
+		if(_console_ != 0xFF) return;
+
+		bool isNew3DS = false;
+		u32 tmp[2][TUNE_KEY_COUNT + 1];
+
+
+		APT_CheckNew3DS(&isNew3DS);
+
+		try
+		{
+			if(fileExist(TUNE_FILE_PATH))
+			{
+				File f(TUNE_FILE_PATH, FS_OPEN_READ);
+
+				// Ignore files of a different version
+				if(f.read(tmp, sizeof(tmp)) == sizeof(tmp) && tmp[0][0] == TUNE_KEY_COUNT && tmp[1][0] == TUNE_KEY_COUNT)
+				{
+					for(u32 i=0; i<2; i++)
+					{
+						for(u32 j=0; j<TUNE_KEY_COUNT; j++)
+						{
+							u32 size = tmp[i][j + 1];
+
+							// Only accept sane power of 2 sizes
+							if(size>=TUNE_MIN_BLOCK && size<=TUNE_MAX_BLOCK && !(size & (size - 1))) _tunedSizes_[i][j] = size;
+						}
+					}
+				}
+			}
+		} catch(fsException& e) {} // Not tuned yet. Use the defaults.
+
+		_console_ = isNew3DS; // Marks the sizes as loaded
+	}
+
+
+	void BlockSizeTuner::save()
+	{
+		u32 tmp[2][TUNE_KEY_COUNT + 1];
+
+
+		for(u32 i=0; i<2; i++)
+		{
+			tmp[i][0] = TUNE_KEY_COUNT;
+			for(u32 j=0; j<TUNE_KEY_COUNT; j++) tmp[i][j + 1] = _tunedSizes_[i][j];
+		}
+
+		try
+		{
+			File f(TUNE_FILE_PATH, FS_OPEN_WRITE|FS_OPEN_CREATE);
+			f.setSize(sizeof(tmp));
+			f.write(tmp, sizeof(tmp));
+		} catch(fsException& e) {} // We will just tune again next time
+	}
+
+
+	//===============================================
+	// class ReadPipe                              ||
+	//===============================================
+
+	ReadPipe::ReadPipe(File& file, u32 blockSize, u32 blockCount) : _file_(file), _blockSize_(blockSize), _blockCount_(blockCount),
+	                                                                 _free_(blockCount, blockCount * 2), _filled_(0, blockCount)
+	{
+		start();
+	}
+
+
+	ReadPipe::ReadPipe(File& file, BlockSizeTuner& tuner, std::function<void (const u8 *block, u32 size)> hook, u32 blockCount)
+	                  : _file_(file), _tuner_(&tuner), _hook_(hook), _blockSize_(tuner.maxBlockSize()),
+	                                                                         _blockCount_(blockCount), _free_(blockCount, blockCount * 2), _filled_(0, blockCount)
+	{
+		start();
+	}
+
+
+	void ReadPipe::start()
+	{
+		_remaining_ = _file_.size() - _file_.tell();
+		_mem_ = new u8[(size_t)_blockSize_ * _blockCount_];
+		_sizes_ = new u32[_blockCount_];
+
+
+		// Without a thread next() reads every block itself
+		_thread_ = new WorkerThread([this]() {readerFunc();});
+		if(!_thread_->started())
+		{
+			delete _thread_;
+			_thread_ = nullptr;
+		}
+	}
+
+
+	ReadPipe::~ReadPipe()
+	{
+		abort();
+		delete _thread_;
+		delete[] _sizes_;
+		delete[] _mem_;
+	}
+
+
+	void ReadPipe::readerFunc()
+	{
+		while(1)
+		{
+			_free_.acquire();
+			if(_abort_ || !readBlock()) return;
+		}
+	}
+
+
+	bool ReadPipe::readBlock()
+	{
+		u32 blockSize;
+		u64 startTick;
+
+
+		startTick = svcGetSystemTick();
+		blockSize = (_tuner_ ? _tuner_->sizeFor(_blockIndex_++) : _blockSize_);
+		if(_remaining_<blockSize) blockSize = _remaining_;
+		if(blockSize>0)
+		{
+			try
+			{
+				blockSize = _file_.read(&_mem_[(size_t)_readPos_ * _blockSize_], blockSize);
+			} catch(fsException& e)
+			{
+				_err_ = e.getErrCode();
+				blockSize = 0;
+			}
+			if(!blockSize && !_err_) _err_ = FS_ERR_DOESNT_EXIST; // File shrunk while reading
+			if(blockSize && _hook_) _hook_(&_mem_[(size_t)_readPos_ * _blockSize_], blockSize);
+		}
+
+		{
+			LockGuard lock(_statsLock_);
+			_readTicks_ += svcGetSystemTick() - startTick;
+		}
+
+		_sizes_[_readPos_] = blockSize;
+		_readPos_ = (_readPos_ + 1) % _blockCount_;
+		_remaining_ -= blockSize;
+		_filled_.release();
+
+		return blockSize>0; // End of file or error. The consumer sees a 0 sized block.
+	}
+
+
+	u32 ReadPipe::next(u8 **block)
+	{
+		u32 blockSize;
+
+
+		if(_holding_)
+		{
+			if(_tuner_) _tuner_->record(_heldSize_);
+			_free_.release(); // Give the previous block back to the reader
+		}
+		_holding_ = false;
+		if(_abort_) return 0;
+
+		if(!_thread_)
+		{
+			_free_.acquire();
+			readBlock();
+		}
+		_filled_.acquire();
+		blockSize = _sizes_[_consumePos_];
+		*block = &_mem_[(size_t)_consumePos_ * _blockSize_];
+		_consumePos_ = (_consumePos_ + 1) % _blockCount_;
+
+		if(!blockSize)
+		{
+			_abort_ = true; // The reader is done. Nothing left to consume.
+			if(_err_) throw fsException(_FILE_, __LINE__, _err_, "Failed to read from file!");
+			return 0;
+		}
+
+		_holding_ = true;
+		_heldSize_ = blockSize;
+		return blockSize;
+	}
+
+
+	void ReadPipe::abort()
+	{
+		_abort_ = true;
+		if(!_thread_) return;
+
+
+		_free_.release(_blockCount_); // Wake up the reader if it waits for a free block
+		_thread_->join();
+	}
+
+
+	u64 ReadPipe::readTicks()
+	{
+		LockGuard lock(_statsLock_);
+		return _readTicks_;
+	}
+
+
+	//===============================================
+	// class WorkQueue                             ||
+	//===============================================
+
+	// Starts COPY_WORKERS_OLD3DS or COPY_WORKERS_NEW3DS threads running func.
+	// Stops early if we run out of threads. Only the SD card gets workers.
+	// Other archives may not like concurrent requests so there are none
+	// unless both archives are the SD card.
+	static void startWorkers(std::vector<std::unique_ptr<WorkerThread>>& workers, std::function<void ()> func, FS_Archive& archive, FS_Archive& otherArchive)
+	{
+		bool isNew3DS = false;
+		u32 count;
+
+
+		if(archive != sdmcArchive || otherArchive != sdmcArchive) return;
+
+		APT_CheckNew3DS(&isNew3DS);
+		count = (isNew3DS ? COPY_WORKERS_NEW3DS : COPY_WORKERS_OLD3DS);
+
+		for(u32 i=0; i<count; i++)
+		{
+			std::unique_ptr<WorkerThread> worker;
+
+			// Core 2 only exists on the New 3DS. Use our own core if the app can't use it.
+			if(isNew3DS && (i & 1)) worker.reset(new WorkerThread(func, 2));
+			if(!worker || !worker->started()) worker.reset(new WorkerThread(func));
+			if(!worker->started()) break;
+
+			workers.push_back(std::move(worker));
+		}
+	}
+
+
+	WorkQueue::WorkQueue(u32 scratchSize, FS_Archive& archive, FS_Archive& otherArchive) : _scratchSize_(scratchSize), _free_(COPY_QUEUE_SIZE, COPY_QUEUE_SIZE),
+	                     _queued_(0, COPY_QUEUE_SIZE + COPY_WORKERS_NEW3DS), _done_(0, 0x7FFFFFFF)
+	{
+		startWorkers(_workers_, [this]() {workerFunc();}, archive, otherArchive);
+	}
+
+
+	WorkQueue::~WorkQueue()
+	{
+		_stop_ = true;
+		_queued_.release(_workers_.size());
+		_workers_.clear(); // Joins them
+	}
+
+
+	void WorkQueue::runJob(const Job& job, u8 *scratch)
+	{
+		try
+		{
+			job(scratch);
+		} catch(fsException& e)
+		{
+			LockGuard lock(_lock_);
+			if(!_error_) _error_.reset(new fsException(e));
+		}
+
+		_done_.release();
+	}
+
+
+	void WorkQueue::workerFunc()
+	{
+		Buffer<u8> scratch(_scratchSize_, false);
+		Job job;
+
+
+		while(1)
+		{
+			_queued_.acquire();
+			if(_stop_) return;
+
+			{
+				LockGuard lock(_lock_);
+				job = std::move(_jobs_.front());
+				_jobs_.pop_front();
+			}
+			_free_.release();
+
+			runJob(job, &scratch);
+		}
+	}
+
+
+	void WorkQueue::checkError()
+	{
+		LockGuard lock(_lock_);
+		if(_error_) throw *_error_;
+	}
+
+
+	void WorkQueue::add(Job job)
+	{
+		checkError();
+
+		// No worker could be started. Do it ourselves.
+		if(_workers_.empty())
+		{
+			Buffer<u8> scratch(_scratchSize_, false);
+			_added_++;
+			runJob(job, &scratch);
+			checkError();
+			return;
+		}
+
+		_free_.acquire();
+		{
+			LockGuard lock(_lock_);
+			_jobs_.push_back(std::move(job));
+		}
+		_queued_.release();
+		_added_++;
+	}
+
+
+	u32 WorkQueue::collect()
+	{
+		u32 count = 0;
+
+
+		while(_collected_<_added_ && _done_.tryAcquire())
+		{
+			_collected_++;
+			count++;
+		}
+
+		checkError();
+		return count;
+	}
+
+
+	u32 WorkQueue::wait()
+	{
+		u32 count = 0;
+
+
+		while(_collected_<_added_)
+		{
+			_done_.acquire();
+			_collected_++;
+			count++;
+		}
+
+		checkError();
+		return count;
+	}
+
+
+	//===============================================
+	// class SmallFileCopier                       ||
+	//===============================================
+
+	// Stores the SHA-256 of the data in hash unless it's nullptr
+	static void copySmallFile(const std::u16string& src, const std::u16string& dst, u8 *buf, FS_Archive& srcArchive, FS_Archive& dstArchive, u8 *hash)
+	{
+		File inFile(src, FS_OPEN_READ, srcArchive), outFile(dst, FS_OPEN_WRITE|FS_OPEN_CREATE, dstArchive);
+		u64 size = inFile.size(), offset = 0;
+		u32 bytesRead;
+		Sha256 sha;
+
+
+		outFile.setSize(size);
+		outFile.setWriteMode(FS_FLUSH_NEVER);
+		while(offset<size && (bytesRead = inFile.read(buf, COPY_SMALL_FILE_SIZE)))
+		{
+			outFile.write(buf, bytesRead);
+			if(hash) sha.update(buf, bytesRead);
+			offset += bytesRead;
+		}
+		outFile.flush();
+		if(hash) sha.finish(hash);
+	}
+
+
+	SmallFileCopier::SmallFileCopier(FS_Archive& srcArchive, FS_Archive& dstArchive) : _srcArchive_(srcArchive), _dstArchive_(dstArchive),
+	                                 _queue_(COPY_SMALL_FILE_SIZE, srcArchive, dstArchive)
+	{
+	}
+
+
+	void SmallFileCopier::add(const std::u16string& src, const std::u16string& dst, u8 *hash)
+	{
+		_queue_.add([this, src, dst, hash](u8 *buf) {copySmallFile(src, dst, buf, _srcArchive_, _dstArchive_, hash);});
+	}
+
+
+	//===============================================
+	// class BulkDeleter                           ||
+	//===============================================
+	// Deletes files and empty dirs on worker threads for deleteTree().
+	// Other archives than the SD card get no workers, see startWorkers().
+	class BulkDeleter
+	{
+		FS_Archive& _archive_;
+		WorkQueue _queue_;
+
+		static void deleteObject(const std::u16string& path, bool isDir, FS_Archive& archive);
+
+
+	public:
+		BulkDeleter(FS_Archive& archive) : _archive_(archive), _queue_(0, archive, archive) {}
+
+
+		void add(const std::u16string& path, bool isDir); // Waits if the queue is full
+		void wait() {_queue_.wait();}
+	};
+
+
+	void BulkDeleter::deleteObject(const std::u16string& path, bool isDir, FS_Archive& archive)
+	{
+		FS_Path fsPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		Result res;
+
+
+		if(isDir)
+		{
+			if((res = FSUSER_DeleteDirectory(archive, fsPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
+		}
+		else if((res = FSUSER_DeleteFile(archive, fsPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete file!");
+	}
+
+
+	void BulkDeleter::add(const std::u16string& path, bool isDir)
+	{
+		_queue_.add([this, path, isDir](u8 *) {deleteObject(path, isDir, _archive_);});
+	}
+
+
+
+	//===============================================
+	// Other file functions                        ||
+	//===============================================
+
+	bool fileExist(const std::u16string& path, FS_Archive& archive)
+	{
+		FS_Path filePath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		Handle fileHandle;
+		Result res;
+		int cached;
+
+
+		if((cached = dirCache.exists(archive, path, false)) >= 0) return cached;
+		if(!FSUSER_OpenFile(&fileHandle, archive, filePath, FS_OPEN_READ, 0))
+		{
+			if((res = FSFILE_Close(fileHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close file!");
+			dirCache.found(archive, path, false);
+			return true;
+		}
+
+		dirCache.notFound(archive, path, false);
+		return false;
+	}
+
+
+	void moveFile(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
+		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
+		Result res;
+
+
+		dirCache.changed(srcArchive, src);
+		dirCache.changed(dstArchive, dst);
+		if((res = FSUSER_RenameFile(srcArchive, srcPath, dstArchive, dstPath)))
+			throw fsException(_FILE_, __LINE__, res, "Failed to move file!");
+	}
+
+
+	// Stores the SHA-256 of the data in hash unless it's nullptr. The reader thread hashes.
+	static u64 copyFileHashed(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive, u8 *hash)
+	{
+		File inFile(src, FS_OPEN_READ, srcArchive), outFile(dst, FS_OPEN_WRITE|FS_OPEN_CREATE, dstArchive);
+		u8 *block;
+		u32 blockSize;
+		u64 inFileSize, offset = 0;
+		Sha256 sha;
+
+
+
+		inFileSize = inFile.size();
+		outFile.setSize(inFileSize);
+
+
+		// The reader thread reads the next blocks while this thread writes.
+		// Nothing is flushed before the whole file is written.
+		BlockSizeTuner tuner((srcArchive == sdmcArchive && dstArchive == sdmcArchive) ? TUNE_COPY_SDMC : TUNE_COPY_OTHER, inFileSize, PIPE_BLOCKS);
+		ReadPipe pipe(inFile, tuner, (hash ? [&sha](const u8 *block, u32 size) {sha.update(block, size);} : std::function<void (const u8 *block, u32 size)>()));
+		outFile.setWriteMode(FS_FLUSH_NEVER);
+
+		while((blockSize = pipe.next(&block)))
+		{
+			outFile.write(block, blockSize);
+
+			offset += blockSize;
+			if(callback) callback(src, offset * 100 / inFileSize);
+		}
+
+		outFile.flush();
+		if(hash) sha.finish(hash); // The reader is done with the last block
+		return offset;
+	}
+
+
+	u64 copyFile(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		return copyFileHashed(src, dst, callback, srcArchive, dstArchive, nullptr);
+	}
+
+
+	void deleteFile(const std::u16string& path, FS_Archive& archive)
+	{
+		FS_Path srcPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		Result res;
+
+
+		dirCache.changed(archive, path);
+		if((res = FSUSER_DeleteFile(archive, srcPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete file!");
+	}
+
+
+	//===============================================
+	// class NameFilter                            ||
+	//===============================================
+
+	NameFilter::NameFilter(const std::u16string& filter)
+	{
+		size_t start = 0, end;
+
+
+		while(start < filter.length())
+		{
+			end = filter.find(u';', start);
+			if(end == std::u16string::npos) end = filter.length();
+
+			Pattern pattern;
+			bool exclude = (filter[start] == u'!');
+			for(size_t i = start + exclude; i < end; i++) pattern.text += foldCase(filter[i]);
+			pattern.glob = (pattern.text.find_first_of(u"*?") != std::u16string::npos);
+
+			if(!pattern.text.empty()) (exclude ? _excludes_ : _includes_).push_back(pattern);
+			start = end + 1;
+		}
+	}
+
+
+	bool NameFilter::matchPattern(const Pattern& pattern, const u16 *name, u32 length)
+	{
+		const u16 *pat = (const u16*)pattern.text.c_str();
+		const u32 patLength = pattern.text.length();
+
+
+		if(!pattern.glob)
+		{
+			if(length < patLength) return false;
+
+			name += length - patLength;
+			for(u32 i=0; i<patLength; i++) if(foldCase(name[i]) != pat[i]) return false;
+			return true;
+		}
+
+		// On a mismatch let the last '*' eat one more char and retry from there
+		u32 p = 0, n = 0, starP = 0, starN = 0;
+		bool star = false;
+		while(n < length)
+		{
+			if(p < patLength && pat[p] == u'*')
+			{
+				star = true;
+				starP = ++p;
+				starN = n;
+			}
+			else if(p < patLength && (pat[p] == u'?' || pat[p] == foldCase(name[n])))
+			{
+				p++;
+				n++;
+			}
+			else if(star)
+			{
+				p = starP;
+				n = ++starN;
+			}
+			else return false;
+		}
+
+		while(p < patLength && pat[p] == u'*') p++;
+		return p == patLength;
+	}
+
+
+	bool NameFilter::match(const u16 *name, u32 length, bool isDir) const
+	{
+		for(auto& it : _excludes_) if(matchPattern(it, name, length)) return false;
+		if(isDir || _includes_.empty()) return true;
+
+		for(auto& it : _includes_) if(matchPattern(it, name, length)) return true;
+		return false;
+	}
+
+
+
+	//===============================================
+	// class DirStream                             ||
+	//===============================================
+
+	DirStream::DirStream(const std::u16string& path, const NameFilter& filter, FS_Archive& archive) : _filter_(filter),
+																									_batch_(new FS_DirectoryEntry[DIR_READ_BATCH]), _entry_(u"", false, 0)
+	{
+		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		Result res;
+
+
+		if((res = FSUSER_OpenDirectory(&_dirHandle_, archive, dirPath)))
+			throw fsException(_FILE_, __LINE__, res, "Failed to open directory!");
+	}
+
+
+	DirStream::~DirStream()
+	{
+		if(_dirHandle_) FSDIR_Close(_dirHandle_);
+	}
+
+
+	bool DirStream::next()
+	{
+		u32 nameLength;
+		Result res;
+
+
+		while(1)
+		{
+			if(_pos_ == _count_)
+			{
+				if(_lastBatch_) return false;
+
+				_pos_ = _count_ = 0;
+				if((res = FSDIR_Read(_dirHandle_, &_count_, DIR_READ_BATCH, _batch_.get()))) throw fsException(_FILE_, __LINE__, res, "Failed to read directory!");
+				_lastBatch_ = _count_ < DIR_READ_BATCH;
+				if(!_count_) return false;
+			}
+
+			const FS_DirectoryEntry& it = _batch_[_pos_++];
+			const bool isDir = it.attributes & FS_ATTRIBUTE_DIRECTORY;
+
+			if(!_filter_.empty())
+			{
+				for(nameLength = 0; nameLength < FS_PATH_MAX_LENGTH && it.name[nameLength]; nameLength++);
+				if(!_filter_.match(it.name, nameLength, isDir)) continue;
+			}
+
+			_entry_.name.assign((const char16_t*)it.name);
+			_entry_.isDir = isDir;
+			_entry_.size = it.fileSize;
+			return true;
+		}
+	}
+
+
+
+	//===============================================
+	// class DirWalker                             ||
+	//===============================================
+
+	DirWalker::DirWalker(const std::u16string& root, FS_Archive& archive) : _archive_(archive), _path_(root), _entry_(nullptr),
+																				_descend_(true), _hasName_(false), _listings_(0)
+	{
+	}
+
+
+	DirWalker::Event DirWalker::next()
+	{
+		if(_descend_)
+		{
+			_stack_.push_back({listDirContents(_path_, u"", _archive_), 0});
+			_listings_++;
+			_descend_ = false;
+			_hasName_ = false;
+		}
+		else if(_hasName_)
+		{
+			removeFromPath(_path_);
+			_hasName_ = false;
+		}
+
+		if(_stack_.empty()) return WALK_END;
+
+
+		Level& level = _stack_.back();
+		if(level.pos < level.entries.size())
+		{
+			_entry_ = &level.entries[level.pos++];
+			addToPath(_path_, _entry_->name);
+			_hasName_ = true;
+
+			if(!_entry_->isDir) return WALK_FILE;
+			_descend_ = true;
+			return WALK_DIR;
+		}
+
+		// Done with this dir. The entries of the parents don't move when popping.
+		_stack_.pop_back();
+		if(_stack_.empty()) return WALK_END;
+
+		_entry_ = &_stack_.back().entries[_stack_.back().pos - 1];
+		_hasName_ = true;
+		return WALK_DIR_DONE;
+	}
+
+
+	void DirWalker::skip()
+	{
+		_descend_ = false;
+	}
+
+
+	std::vector<DirWalker::Step> DirWalker::steps()
+	{
+		std::vector<Step> steps;
+		Event event;
+
+		while((event = next()) != WALK_END) steps.push_back({event, _entry_->name, _entry_->size});
+
+		return steps;
 	}
 
 
+
 	//===============================================
-	// Other file functions                        ||
+	// class DirCounter                            ||
 	//===============================================
 
-	bool fileExist(const std::u16string& path, FS_Archive& archive)
+	DirCounter::DirCounter(const std::u16string& path, FS_Archive& archive) : _archive_(archive), _queued_(0, 0x7FFFFFFF), _finished_(0, 1)
 	{
-		FS_Path filePath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
-		Handle fileHandle;
-		Result res;
-
+		_dirs_.push_back(path);
+		startWorkers(_workers_, [this]() {workerFunc();}, archive, archive);
 
-		if(!FSUSER_OpenFile(&fileHandle, archive, filePath, FS_OPEN_READ, 0))
+		// No worker could be started. Do it ourselves.
+		if(_workers_.empty())
 		{
-			if((res = FSFILE_Close(fileHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close file!");
-			return true;
+			while(!_dirs_.empty())
+			{
+				const std::u16string dir = _dirs_.front();
+				_dirs_.pop_front();
+				countDir(dir);
+			}
+			_pending_ = 0;
+			_done_ = true;
+			return;
 		}
 
-		return false;
+		_queued_.release();
 	}
 
 
-	void moveFile(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	DirCounter::~DirCounter()
 	{
-		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
-		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
-		Result res;
-
-
-		if((res = FSUSER_RenameFile(srcArchive, srcPath, dstArchive, dstPath)))
-			throw fsException(_FILE_, __LINE__, res, "Failed to move file!");
+		_stop_ = true;
+		_queued_.release(_workers_.size());
+		_workers_.clear(); // Joins them
 	}
 
 
-	u64 copyFile(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	void DirCounter::workerFunc()
 	{
-		File inFile(src, FS_OPEN_READ, srcArchive), outFile(dst, FS_OPEN_WRITE|FS_OPEN_CREATE, dstArchive);
-		u32 blockSize;
-		u64 inFileSize, offset = 0;
+		std::u16string path;
+		bool last;
 
 
+		while(1)
+		{
+			_queued_.acquire();
+			if(_stop_) return;
 
-		inFileSize = inFile.size();
-		outFile.setSize(inFileSize);
+			{
+				LockGuard lock(_lock_);
+				path = _dirs_.front();
+				_dirs_.pop_front();
+			}
 
+			try
+			{
+				countDir(path);
+			} catch(fsException& e)
+			{
+				LockGuard lock(_lock_);
+				if(!_error_) _error_.reset(new fsException(e));
+			}
 
-		Buffer<u8> buffer(MAX_BUF_SIZE, false);
+			{
+				LockGuard lock(_lock_);
+				last = !--_pending_;
+			}
+			if(last)
+			{
+				_done_ = true;
+				_finished_.release();
+			}
+		}
+	}
 
 
-		for(u32 i=0; i<=inFileSize / MAX_BUF_SIZE; i++)
-		{
-			blockSize = ((inFileSize - offset<MAX_BUF_SIZE) ? inFileSize - offset : MAX_BUF_SIZE);
+	void DirCounter::countDir(const std::u16string& path)
+	{
+		std::vector<DirEntry> entries = listDirContents(path, u"", _archive_);
+		DirInfo info = {0, 0, 0};
+		u32 subdirs = 0;
+		std::u16string subdir;
 
-			if(blockSize>0)
-			{
-				inFile.read(&buffer, blockSize);
-				outFile.write(&buffer, blockSize);
 
-				offset += blockSize;
-				if(callback) callback(src, offset * 100 / inFileSize);
+		LockGuard lock(_lock_);
+
+		for(auto& it : entries)
+		{
+			if(it.isDir)
+			{
+				subdir = path;
+				addToPath(subdir, it.name);
+				_dirs_.push_back(subdir);
+				info.dirCount++;
+				subdirs++;
+			}
+			else
+			{
+				info.fileCount++;
+				info.size += it.size;
 			}
 		}
 
-		return offset;
+		_info_.fileCount += info.fileCount;
+		_info_.dirCount += info.dirCount;
+		_info_.size += info.size;
+		_pending_ += subdirs;
+		if(!_workers_.empty() && subdirs) _queued_.release(subdirs);
 	}
 
 
-	void deleteFile(const std::u16string& path, FS_Archive& archive)
+	DirInfo DirCounter::wait()
 	{
-		FS_Path srcPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
-		Result res;
+		if(!_done_) _finished_.acquire();
 
+		LockGuard lock(_lock_);
+		if(_error_) throw *_error_;
 
-		if((res = FSUSER_DeleteFile(archive, srcPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete file!");
+		return _info_;
+	}
+
+
+	DirInfo DirCounter::partial()
+	{
+		LockGuard lock(_lock_);
+		return _info_;
 	}
 
 
+
 	//===============================================
 	// Directory related functions                 ||
 	//===============================================
@@ -290,14 +1883,18 @@ namespace fs
 		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
 		Handle dirHandle;
 		Result res;
+		int cached;
 
 
+		if((cached = dirCache.exists(archive, path, true)) >= 0) return cached;
 		if(!FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
 		{
 			if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+			dirCache.found(archive, path, true);
 			return true;
 		}
 
+		dirCache.notFound(archive, path, true);
 		return false;
 	}
 
@@ -305,259 +1902,540 @@ namespace fs
 	void makeDir(const std::u16string& path, FS_Archive& archive)
 	{
 		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
-		Handle dirHandle;
 		Result res;
 
 
-		if(!FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
-		{
-			if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
-			return;
-		}
+		if(dirExist(path, archive)) return;
 		if((res = FSUSER_CreateDirectory(archive, dirPath, 0)))
 			throw fsException(_FILE_, __LINE__, res, "Failed to create directory!");
+		dirCache.dirMade(archive, path);
 	}
 
 
+	// Starts below the deepest dir the cache knows. Dirs made on the way are
+	// known to be empty so everything below them costs no lookups.
 	void makePath(const std::u16string& path, FS_Archive& archive)
 	{
-		std::u16string tmp;
-		size_t found = 0;
+		size_t found = path.length();
 
 
 		if(path.length() < 2 || path.find_first_of(u"/") == std::u16string::npos) return;
-		while(found != std::u16string::npos)
+		while(found && found != std::u16string::npos && dirCache.exists(archive, path.substr(0, found), true) != 1)
 		{
-			found = path.find_first_of(u"/", found+1);
-			tmp.assign(path, 0, found);
-			makeDir(tmp, archive);
+			found = path.find_last_of(u"/", found - 1);
+		}
+
+		if(found == std::u16string::npos) found = 0;
+		while(found != path.length())
+		{
+			found = path.find_first_of(u"/", found + 1);
+			if(found == std::u16string::npos) found = path.length();
+			makeDir(path.substr(0, found), archive);
 		}
 	}
 
 
 	DirInfo getDirInfo(const std::u16string& path, FS_Archive& archive)
 	{
-		u32 depth = 0;
-		u16 helper[128]; // Anyone uses higher dir depths?
-		DirInfo dirInfo = {0};
+		return DirCounter(path, archive).wait();
+	}
 
-		std::u16string tmpPath(path);
 
+	// Filter format is "entry1;entry2;..." for example ".txt;.png;". "" means list everything.
+	// See NameFilter for the details.
+	std::vector<DirEntry> listDirContents(const std::u16string& path, const std::u16string filter, FS_Archive& archive)
+	{
+		return listDirContents(path, NameFilter(filter), archive);
+	}
 
 
-		std::vector<DirEntry> entries = listDirContents(tmpPath, u"", archive);
-		helper[0] = 0; // We are in the root at file/folder 0
+	std::vector<DirEntry> listDirContents(const std::u16string& path, const NameFilter& filter, FS_Archive& archive)
+	{
+		std::vector<DirEntry> filesFolders;
 
 
-		while(1)
+		// The cache keeps complete listings. Filter afterwards.
+		if(!dirCache.getListing(archive, path, filesFolders))
 		{
-			// Prevent non-existent member access
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir)
-			{
-				addToPath(tmpPath, entries[helper[depth]].name);
-				dirInfo.dirCount++;
+			for(auto& it : DirStream(path, NameFilter(), archive)) filesFolders.push_back(it);
+			sortDirEntries(filesFolders);
+			dirCache.putListing(archive, path, filesFolders);
+		}
+
+		if(!filter.empty())
+		{
+			filesFolders.erase(std::remove_if(filesFolders.begin(), filesFolders.end(), [&](const DirEntry& entry)
+																								{
+																									return !filter.match(entry.name, entry.isDir);
+																								}), filesFolders.end());
+		}
+
+		return filesFolders;
+	}
+
+
+	// Precomputed sort key of a DirEntry. Dirs come first, A-Z are folded and
+	// digit runs are compared by value ("2" < "10"). A digit run is stored as
+	// '0', the number of significant digits and the digits.
+	static void appendSortKey(const DirEntry& entry, std::vector<char16_t>& keys)
+	{
+		const std::u16string& name = entry.name;
+		size_t i = 0, end, first;
 
-				helper[++depth] = 0; // Go 1 up in the fs tree and reset position
-				entries = listDirContents(tmpPath, u"", archive);
-			}
 
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir) continue;
+		keys.push_back(entry.isDir ? u'\x01' : u'\x02'); // Never 0 so shorter keys sort first
 
-			for(auto it : entries)
+		while(i < name.length())
+		{
+			if(name[i] < u'0' || name[i] > u'9')
 			{
-				if(!it.isDir)
-				{
-					dirInfo.fileCount++;
-					dirInfo.size += it.size;
-				}
+				keys.push_back(foldCase(name[i++]));
+				continue;
 			}
 
-			if(!depth) break;
+			for(end = i; end < name.length() && name[end] >= u'0' && name[end] <= u'9'; end++);
+			for(first = i; first < end - 1 && name[first] == u'0'; first++);
+
+			keys.push_back(u'0');
+			keys.push_back((char16_t)(end - first));
+			keys.insert(keys.end(), name.begin() + first, name.begin() + end);
+			i = end;
+		}
+	}
+
+	// The first 16 key units as bytes so most comparisons are two u64 compares.
+	// Packing stops at the first unit that doesn't fit. That keeps the order.
+	static void sortKeyPrefix(const char16_t *key, u32 length, u64 *prefix)
+	{
+		u32 unit = 0;
+
+
+		prefix[0] = prefix[1] = 0;
+		for(; unit < 16 && unit < length; unit++)
+		{
+			prefix[unit / 8] |= (u64)(key[unit] < 0xFF ? key[unit] : 0xFF)<<(8 * (7 - unit % 8));
+			if(key[unit] >= 0xFF) break;
+		}
+	}
+
+
+	void sortDirEntries(std::vector<DirEntry>& entries, size_t count)
+	{
+		struct SortItem
+		{
+			u64 prefix[2];
+			u32 offset, length; // Of the key in keys
+			u32 index;
+		};
+
+		std::vector<char16_t> keys;
+		std::vector<SortItem> items(entries.size());
+		std::vector<DirEntry> sorted;
+		size_t nameUnits = 0;
 
-			removeFromPath(tmpPath);
 
-			helper[--depth]++; // Go 1 down in the fs tree and increase position
-			entries = listDirContents(tmpPath, u"", archive);
+		// All keys go into one buffer
+		for(auto& it : entries) nameUnits += it.name.length() + 3;
+		keys.reserve(nameUnits);
+
+		for(u32 i = 0; i < entries.size(); i++)
+		{
+			items[i].offset = keys.size();
+			appendSortKey(entries[i], keys);
+			items[i].length = keys.size() - items[i].offset;
+			items[i].index = i;
 		}
+		for(auto& it : items) sortKeyPrefix(&keys[it.offset], it.length, it.prefix);
+
+		auto less = [&](const SortItem& first, const SortItem& second)
+		{
+			if(first.prefix[0] != second.prefix[0]) return first.prefix[0] < second.prefix[0];
+			if(first.prefix[1] != second.prefix[1]) return first.prefix[1] < second.prefix[1];
 
-		return dirInfo;
+			int cmp = std::char_traits<char16_t>::compare(&keys[first.offset], &keys[second.offset], std::min(first.length, second.length));
+			if(!cmp) cmp = (first.length != second.length ? (first.length < second.length ? -1 : 1) : 0);
+			if(!cmp) cmp = entries[first.index].name.compare(entries[second.index].name); // "01" and "1"
+			return cmp < 0;
+		};
+
+		if(count && count < items.size()) std::partial_sort(items.begin(), items.begin() + count, items.end(), less);
+		else std::sort(items.begin(), items.end(), less);
+
+		sorted.reserve(entries.size());
+		for(auto& it : items) sorted.push_back(std::move(entries[it.index]));
+		entries.swap(sorted);
 	}
 
 
-	// Filter format is "entry1;entry2;..." for example ".txt;.png;". "" means list everything
-	std::vector<DirEntry> listDirContents(const std::u16string& path, const std::u16string filter, FS_Archive& archive)
+	void moveDir(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
 	{
-		bool useFilter = false;
-		Handle dirHandle;
-		u32 entriesRead;
+		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
+		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
 		Result res;
 
-		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
-		std::vector<DirEntry> filesFolders;
-		if(filter.length() > 0) useFilter = true;
 
+		dirCache.removeTree(srcArchive, src);
+		dirCache.removeTree(dstArchive, dst);
+		if((res = FSUSER_RenameDirectory(srcArchive, srcPath, dstArchive, dstPath))) throw fsException(_FILE_, __LINE__, res, "Failed to move directory!");
+	}
 
 
-		if((res = FSUSER_OpenDirectory(&dirHandle, archive, dirPath)))
-			throw fsException(_FILE_, __LINE__, res, "Failed to open directory!");
+	// Hashes of the files at a copyDir() destination keyed by the path
+	// relative to the destination root
+	class CopyIndex
+	{
+		struct Entry
+		{
+			u64 size;
+			u8  hash[SHA256_HASH_SIZE];
+		};
 
+		std::map<std::u16string, Entry> _entries_;
 
-		Buffer<FS_DirectoryEntry> entries(32, false);
 
+	public:
+		void load(const std::u16string& path, FS_Archive& archive);
+		void save(const std::u16string& path, FS_Archive& archive);
 
-		do
+		bool get(const std::u16string& name, u64 size, u8 *hash);
+		void set(const std::u16string& name, u64 size, const u8 *hash) {Entry& e = _entries_[name]; e.size = size; memcpy(e.hash, hash, SHA256_HASH_SIZE);}
+	};
+
+
+	// Layout: "CIDX", u32 count and per entry u16 name length, name, u64 size, hash
+	void CopyIndex::load(const std::u16string& path, FS_Archive& archive)
+	{
+		std::vector<u8> data;
+		u32 count, pos = 8;
+
+
+		try
 		{
-			entriesRead = 0;
-			filesFolders.reserve(filesFolders.size()+32); // Save time by reserving enough mem
-			if((res = FSDIR_Read(dirHandle, &entriesRead, 32, &entries))) throw fsException(_FILE_, __LINE__, res, "Failed to read directory!");
+			if(!fileExist(path, archive)) return;
 
-			if(useFilter)
-			{
-				for(u32 i=0; i<entriesRead; i++)
-				{
-					if(!(entries[i].attributes & FS_ATTRIBUTE_DIRECTORY))
-					{
-						size_t foundOld = 0;
-						size_t found = 0;
-						const std::u16string file((char16_t*)entries[i].name);
+			File f(path, FS_OPEN_READ, archive);
+			data.resize(f.size());
+			if(data.size()<8 || f.read(&data[0], data.size()) != data.size() || memcmp(&data[0], "CIDX", 4)) return;
+		} catch(fsException& e) {return;} // Everything is hashed again
 
-						while(1)
-						{
-							found = filter.find_first_of(u";", found+1);
-							if(found == std::u16string::npos) break;
-							if(foundOld > 0) foundOld++; // Skip the separator
-							if(file.length() < found-foundOld) continue;
-              if(file.compare(file.length()-(found-foundOld), found-foundOld, filter, foundOld, found-foundOld) == 0) filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
-							foundOld = found;
-						}
-					}
-					else
-					{
-						filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
-					}
-				}
-			}
-			else
-			{
-				for(u32 i=0; i<entriesRead; i++)
-				{
-					filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
-				}
-			}
-		} while(entriesRead == 32);
+		memcpy(&count, &data[4], 4);
+		for(u32 i=0; i<count; i++)
+		{
+			u16 nameLen;
+			Entry entry;
+
+			if(data.size() - pos<2) break;
+			memcpy(&nameLen, &data[pos], 2);
+			if(data.size() - pos - 2<nameLen * 2u + 8 + SHA256_HASH_SIZE) break;
+
+			std::u16string name((const char16_t*)&data[pos + 2], nameLen);
+			pos += 2 + nameLen * 2;
+			memcpy(&entry.size, &data[pos], 8);
+			memcpy(entry.hash, &data[pos + 8], SHA256_HASH_SIZE);
+			pos += 8 + SHA256_HASH_SIZE;
+
+			_entries_[name] = entry;
+		}
+	}
 
 
+	void CopyIndex::save(const std::u16string& path, FS_Archive& archive)
+	{
+		std::vector<u8> data(8);
+		u32 count = _entries_.size();
 
-		// If we reserved too much mem shrink it
-		filesFolders.shrink_to_fit();
 
-		// Sort folders and files
-		std::sort(filesFolders.begin(), filesFolders.end(), fileNameCmp);
+		memcpy(&data[0], "CIDX", 4);
+		memcpy(&data[4], &count, 4);
+		for(auto& it : _entries_)
+		{
+			u16 nameLen = it.first.length();
+			size_t pos = data.size();
+
+			data.resize(pos + 2 + nameLen * 2 + 8 + SHA256_HASH_SIZE);
+			memcpy(&data[pos], &nameLen, 2);
+			memcpy(&data[pos + 2], it.first.c_str(), nameLen * 2);
+			memcpy(&data[pos + 2 + nameLen * 2], &it.second.size, 8);
+			memcpy(&data[pos + 2 + nameLen * 2 + 8], it.second.hash, SHA256_HASH_SIZE);
+		}
 
+		File f(path, FS_OPEN_WRITE|FS_OPEN_CREATE, archive);
+		f.setSize(data.size());
+		f.write(&data[0], data.size());
+	}
 
 
-		if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+	bool CopyIndex::get(const std::u16string& name, u64 size, u8 *hash)
+	{
+		auto it = _entries_.find(name);
 
-		return filesFolders;
+		if(it == _entries_.end() || it->second.size != size) return false;
+		memcpy(hash, it->second.hash, SHA256_HASH_SIZE);
+		return true;
 	}
 
 
-	void moveDir(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	// A file copyDir() copied. hash is filled in by the copy.
+	struct CopiedFile
 	{
-		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
-		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
-		Result res;
+		std::u16string relPath;
+		u64 size;
+		u8  hash[SHA256_HASH_SIZE];
+	};
 
 
-		if((res = FSUSER_RenameDirectory(srcArchive, srcPath, dstArchive, dstPath))) throw fsException(_FILE_, __LINE__, res, "Failed to move directory!");
+	// Hashes one block while the next one is read
+	static void hashFile(const std::u16string& path, u8 *hash, FS_Archive& archive)
+	{
+		File f(path, FS_OPEN_READ, archive);
+		u64 size = f.size(), offset = 0;
+		u32 blockSize = ((size && size<MAX_BUF_SIZE) ? size : MAX_BUF_SIZE);
+		Buffer<u8> buf0(blockSize, false), buf1(size > blockSize ? blockSize : 1, false);
+		u8 *buf[2] = {&buf0, &buf1};
+		Sha256 sha;
+		IoHandle req;
+		u32 bytesRead, cur = 0;
+
+
+		if(size) req = f.readAsync(buf[cur], blockSize, 0);
+		while(req && (bytesRead = req->wait()))
+		{
+			offset += bytesRead;
+			req.reset();
+			if(offset<size) req = f.readAsync(buf[cur ^ 1], blockSize, offset);
+
+			sha.update(buf[cur], bytesRead);
+			cur ^= 1;
+		}
+		sha.finish(hash);
 	}
 
 
-	void copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	CopyStats copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive, bool incremental, bool estimate)
 	{
-		u32 depth = 0, fileCount = 0, dirCount = 0;
-		u16 helper[128]; // Anyone uses higher dir depths?
+		u32 fileCount = 0, dirCount = 0, total = 0, lastPercent = 0;
+
+		// The counter fills the dir cache for the walker. Without estimate we wait for the real total.
+		std::unique_ptr<DirCounter> counter(new DirCounter(src, srcArchive));
+		bool totalKnown = false;
+		DirWalker walker(src, srcArchive);
+		DirWalker::Event event;
+		std::u16string tmpOutPath(dst), indexPath(dst);
+		SmallFileCopier smallFiles(srcArchive, dstArchive); // Big files are streamed by this thread meanwhile
+		CopyStats stats = {0, 0};
+		CopyIndex index;
+		std::deque<CopiedFile> copied; // Small files get their hash when the workers are done
+		std::map<std::u16string, u64> dstSizes;
+		std::u16string dstSizesDir;
+		u8 srcHash[SHA256_HASH_SIZE], dstHash[SHA256_HASH_SIZE];
+
+
+		auto totalPercent = [&]()
+		{
+			u32 done = fileCount + dirCount, percent;
 
-		DirInfo inDirInfo = getDirInfo(src, srcArchive);
-		std::u16string tmpInPath(src);
-		std::u16string tmpOutPath(dst);
+			if(!totalKnown && counter->done())
+			{
+				DirInfo info = counter->wait();
+				total = info.fileCount + info.dirCount;
+				totalKnown = true;
+			}
+
+			if(totalKnown) percent = done * 100 / (total ? total : 1);
+			else
+			{
+				// Everything counted so far but at least one more to go
+				DirInfo info = counter->partial();
+				percent = done * 100 / std::max(info.fileCount + info.dirCount, done + 1);
+				if(percent > 99) percent = 99;
+			}
 
+			lastPercent = std::max(lastPercent, percent);
+			return lastPercent;
+		};
 
+		if(!estimate)
+		{
+			DirInfo info = counter->wait();
+			total = info.fileCount + info.dirCount;
+			totalKnown = true;
+		}
 
 		// Create the specified path if it doesn't exist
 		makePath(tmpOutPath, dstArchive);
-		std::vector<DirEntry> entries = listDirContents(tmpInPath, u"", srcArchive);
-		helper[0] = 0; // We are in the root at file/folder 0
+		addToPath(indexPath, COPY_INDEX_NAME);
+		if(incremental) index.load(indexPath, dstArchive);
 
 
-		while(1)
+		while((event = walker.next()) != DirWalker::WALK_END)
 		{
-			// Prevent non-existent member access
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir)
+			const std::u16string& tmpInPath = walker.path();
+			const DirEntry& it = walker.entry();
+
+			if(event == DirWalker::WALK_DIR)
 			{
-				addToPath(tmpInPath, entries[helper[depth]].name);
-				addToPath(tmpOutPath, entries[helper[depth]].name);
-				if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
+				addToPath(tmpOutPath, it.name);
+				if(callback) callback(tmpInPath, totalPercent(), 0);
 				makeDir(tmpOutPath, dstArchive);
 				dirCount++;
+				continue;
+			}
+			if(event == DirWalker::WALK_DIR_DONE)
+			{
+				removeFromPath(tmpOutPath);
+				continue;
+			}
+
+			if(incremental && !walker.depth() && it.name == COPY_INDEX_NAME) {fileCount++; continue;} // Belongs to the source tree
 
-				helper[++depth] = 0; // Go 1 up in the fs tree and reset position
-				entries = listDirContents(tmpInPath, u"", srcArchive);
+			// Sizes of the files already at the destination. The files of a dir come in one run.
+			if(incremental && dstSizesDir != tmpOutPath)
+			{
+				dstSizes.clear();
+				for(auto& dstIt : DirStream(tmpOutPath, NameFilter(), dstArchive)) if(!dstIt.isDir) dstSizes[dstIt.name] = dstIt.size;
+				dstSizesDir = tmpOutPath;
 			}
 
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir) continue;
+			addToPath(tmpOutPath, it.name);
 
-			for(auto it : entries)
+			u8 *hash = nullptr; // Where the copy stores its hash for the index
+			if(incremental)
 			{
-				if(!it.isDir)
+				const std::u16string relPath = tmpOutPath.substr(dst.length());
+				auto dstSize = dstSizes.find(it.name);
+
+				// Same size. Compare the content.
+				if(dstSize != dstSizes.end() && dstSize->second == it.size)
+				{
+					hashFile(tmpInPath, srcHash, srcArchive);
+					if(!index.get(relPath, it.size, dstHash)) hashFile(tmpOutPath, dstHash, dstArchive);
+
+					index.set(relPath, it.size, srcHash);
+					if(!memcmp(srcHash, dstHash, SHA256_HASH_SIZE))
+					{
+						stats.skippedBytes += it.size;
+						fileCount += 1 + smallFiles.collect();
+						if(callback) callback(tmpInPath, totalPercent(), 100);
+
+						removeFromPath(tmpOutPath);
+						continue;
+					}
+				}
+				else
 				{
-					addToPath(tmpInPath, it.name);
-					addToPath(tmpOutPath, it.name);
-					if(callback) copyFile(tmpInPath, tmpOutPath, [&](const std::u16string& file, u32 percent)
-																												{
-																													callback(file, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), percent);
-																												}, srcArchive, dstArchive);
-					else copyFile(tmpInPath, tmpOutPath, nullptr, srcArchive, dstArchive);
-					fileCount++;
-					removeFromPath(tmpInPath);
-					removeFromPath(tmpOutPath);
+					copied.push_back({relPath, it.size, {}});
+					hash = copied.back().hash;
 				}
 			}
 
-			if(!depth) break;
-
-			removeFromPath(tmpInPath);
+			if(it.size<=COPY_SMALL_FILE_SIZE)
+			{
+				smallFiles.add(tmpInPath, tmpOutPath, hash);
+				stats.copiedBytes += it.size;
+				fileCount += smallFiles.collect();
+				if(callback) callback(tmpInPath, totalPercent(), 0);
+			}
+			else
+			{
+				if(callback) stats.copiedBytes += copyFileHashed(tmpInPath, tmpOutPath, [&](const std::u16string& file, u32 percent)
+																											{
+																												callback(file, totalPercent(), percent);
+																											}, srcArchive, dstArchive, hash);
+				else stats.copiedBytes += copyFileHashed(tmpInPath, tmpOutPath, nullptr, srcArchive, dstArchive, hash);
+				fileCount += 1 + smallFiles.collect();
+			}
 			removeFromPath(tmpOutPath);
+		}
 
-			helper[--depth]++; // Go 1 down in the fs tree and increase position
-			entries = listDirContents(tmpInPath, u"", srcArchive);
+		fileCount += smallFiles.wait();
+		counter.reset(); // Stops it if the walk was faster
+		if(incremental)
+		{
+			for(auto& it : copied) index.set(it.relPath, it.size, it.hash);
+			index.save(indexPath, dstArchive);
 		}
 
-		if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
+		// The walk is done so everything is counted now
+		total = fileCount + dirCount;
+		totalKnown = true;
+		if(callback) callback(src, totalPercent(), 0);
+
+		return stats;
 	}
 
 
-	void deleteDir(const std::u16string& path, FS_Archive& archive)
+
+
+	DeleteStats deleteDir(const std::u16string& path, FS_Archive& archive)
 	{
 		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		const u64 startTick = svcGetSystemTick();
+		DeleteStats stats = {0, 0, 0};
 		Result res;
 
 
-		if(path.compare(u"/") != 0)
-		{
-			if((res = FSUSER_DeleteDirectoryRecursively(archive, dirPath)))
-				throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
-		}
-		else // We can't delete "/" itself so delete everything in root
+		// We can't delete "/" itself so delete everything in root
+		if(path.compare(u"/") == 0) return deleteTree(path, archive);
+
+		dirCache.removeTree(archive, path);
+		if((res = FSUSER_DeleteDirectoryRecursively(archive, dirPath)))
+			throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
+
+		stats.ticks = svcGetSystemTick() - startTick;
+		return stats;
+	}
+
+
+	DeleteStats deleteTree(const std::u16string& path, FS_Archive& archive)
+	{
+		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		const u64 startTick = svcGetSystemTick();
+		DeleteStats stats = {0, 0, 0};
+		std::vector<std::vector<std::u16string>> dirs; // By depth
+		DirWalker::Event event;
+		Result res;
+
+
+		dirCache.removeTree(archive, path); // List what is really there
+
 		{
-			std::vector<DirEntry> list = listDirContents(path, u"", archive);
+			BulkDeleter deleter(archive);
+			DirWalker walker(path, archive);
+
+			// The files go while the walk goes on
+			while((event = walker.next()) != DirWalker::WALK_END)
+			{
+				if(event == DirWalker::WALK_FILE)
+				{
+					deleter.add(walker.path(), false);
+					stats.fileCount++;
+				}
+				else if(event == DirWalker::WALK_DIR)
+				{
+					if(dirs.size() <= walker.depth()) dirs.resize(walker.depth() + 1);
+					dirs[walker.depth()].push_back(walker.path());
+				}
+			}
+			deleter.wait();
 
-			for(auto it : list)
+			// A level of dirs is empty once the level below is gone
+			for(size_t depth = dirs.size(); depth--;)
 			{
-				if(it.isDir) deleteDir(u"/" + it.name, archive);
-				else deleteFile(u"/" + it.name, archive);
+				for(auto& it : dirs[depth]) deleter.add(it, true);
+				deleter.wait();
+				stats.dirCount += dirs[depth].size();
 			}
 		}
+
+		dirCache.removeTree(archive, path);
+		if(path.compare(u"/") != 0)
+		{
+			if((res = FSUSER_DeleteDirectory(archive, dirPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
+			stats.dirCount++;
+		}
+
+		stats.ticks = svcGetSystemTick() - startTick;
+		return stats;
 	}
 
 
@@ -632,70 +2510,55 @@ namespace fs
 
 	void zipDir(const std::u16string& src, const std::u16string& zipDst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback, FS_Archive& srcArchive)
 	{
-		u32 depth = 0, fileCount = 0, dirCount = 0;
-		u16 helper[128]; // Anyone uses higher dir depths?
+		u32 fileCount = 0, dirCount = 0, total = 0;
 		Result res;
 
-		DirInfo inDirInfo = getDirInfo(src, srcArchive);
+		const std::vector<DirWalker::Step> steps = DirWalker(src, srcArchive).steps();
 		std::u16string tmpInPath(src);
 		std::string zipPath; // Zip internal path starts without a slash
 
 
+		for(auto& it : steps) if(it.event != DirWalker::WALK_DIR_DONE) total++;
+		if(!total) total = 1; // Empty dir
 
 		// Create new zip file deleting existing ones without a warning!
 		if(fileExist(zipDst)) deleteFile(zipDst);
 		zipFile zip = zipOpen2(zipDst.c_str(), APPEND_STATUS_CREATE, nullptr, nullptr);
 		if(!zip) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Failed to create ZIP file!");
 
-		std::vector<DirEntry> entries = listDirContents(tmpInPath, u"", srcArchive);
-		helper[0] = 0; // We are in the root at file/folder 0
 
-
-		while(1)
+		for(auto& it : steps)
 		{
-			// Prevent non-existent member access
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir)
+			if(it.event == DirWalker::WALK_DIR)
 			{
-				addToPath(tmpInPath, entries[helper[depth]].name);
-				addToZipPath(zipPath, entries[helper[depth]].name, true);
-				if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
+				addToPath(tmpInPath, it.name);
+				addToZipPath(zipPath, it.name, true);
+				if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / total, 0);
 				makeDirInZip(zipPath, zip);
 				dirCount++;
-
-				helper[++depth] = 0; // Go 1 up in the fs tree and reset position
-				entries = listDirContents(tmpInPath, u"", srcArchive);
 			}
-
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir) continue;
-
-			for(auto it : entries)
+			else if(it.event == DirWalker::WALK_DIR_DONE)
 			{
-				if(!it.isDir)
-				{
-					addToPath(tmpInPath, it.name);
-					addToZipPath(zipPath, it.name, false);
-					if(callback) copyFileToZip(tmpInPath, zipPath, zip, [&](const std::u16string& file, u32 percent)
-																															{
-																																callback(file, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), percent);
-																															}, srcArchive);
-					else copyFileToZip(tmpInPath, zipPath, zip, nullptr, srcArchive);
-					fileCount++;
-					removeFromPath(tmpInPath);
-					removeFromZipPath(zipPath);
-				}
+				removeFromPath(tmpInPath);
+				removeFromZipPath(zipPath);
+			}
+			else
+			{
+				addToPath(tmpInPath, it.name);
+				addToZipPath(zipPath, it.name, false);
+				if(callback) copyFileToZip(tmpInPath, zipPath, zip, [&](const std::u16string& file, u32 percent)
+																														{
+																															callback(file, (fileCount + dirCount) * 100 / total, percent);
+																														}, srcArchive);
+				else copyFileToZip(tmpInPath, zipPath, zip, nullptr, srcArchive);
+				fileCount++;
+				removeFromPath(tmpInPath);
+				removeFromZipPath(zipPath);
 			}
-
-			if(!depth) break;
-
-			removeFromPath(tmpInPath);
-			removeFromZipPath(zipPath);
-
-			helper[--depth]++; // Go 1 down in the fs tree and increase position
-			entries = listDirContents(tmpInPath, u"", srcArchive);
 		}
 
 		if((res = zipClose(zip, nullptr)) != ZIP_OK) throw fsException(_FILE_, __LINE__, res, "Failed to close ZIP file!");
-		if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
+		if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / total, 0);
 	}
 
 
@@ -810,8 +2673,17 @@ namespace fs
 	// Misc functions                              ||
 	//===============================================
 
+	void clearDirCache()
+	{
+		dirCache.clear();
+	}
+
+
+
+	// "/a/b/" gets the same result as "/a/b" like in the dir cache
 	void addToPath(std::u16string& path, const std::u16string& dirOrFile)
 	{
+		while(path.length()>1 && path.back() == u'/') path.pop_back();
 		if(path.length()>1) path += (u"/" + dirOrFile);
 		else path += dirOrFile;
 	}
@@ -0,0 +1,136 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+
+#include <cstdio>
+#include <string>
+#include <3ds.h>
+#include "fs.h"
+#include "misc.h"
+#include "report.h"
+
+
+
+static double ticksToMs(u64 ticks)
+{
+	return (double)ticks / TICKS_PER_MSEC;
+}
+
+
+// MiB/s over the given time
+static double throughput(u64 bytes, u64 ticks)
+{
+	if(!ticks) return 0.0;
+	return (double)bytes / 1048576.0 / ((double)ticks / SYSCLOCK_ARM11);
+}
+
+
+// Quoted CSV field. Quotes inside are doubled.
+static std::string csvQuote(const std::string& str)
+{
+	std::string quoted = "\"";
+
+	for(auto c : str)
+	{
+		if(c == '"') quoted += '"';
+		quoted += c;
+	}
+
+	return quoted + '"';
+}
+
+
+void InstallReport::add(const std::u16string& name, const AM_TitleEntry& entry, const InstallStats& stats, u64 firmTicks, u64 totalTicks)
+{
+	Buffer<char> tmpStr(256);
+	Row row;
+
+
+	utf16_to_utf8((u8*) &tmpStr, (const u16*) name.c_str(), 255);
+	row.name = &tmpStr;
+	row.titleID = entry.titleID;
+	row.version = entry.version;
+	row.stats = stats;
+	row.firmTicks = firmTicks;
+	row.totalTicks = totalTicks;
+
+	_rows_.push_back(row);
+}
+
+
+void InstallReport::save(bool complete, const std::u16string& path)
+{
+	std::string csv = "name,titleID,version,bytes,readMs,writeMs,finishMs,firmMs,prefetchMs,totalMs,MiBps,verified,skipped\n";
+	char line[384];
+	u64 bytes = 0, readTicks = 0, writeTicks = 0, finishTicks = 0, firmTicks = 0, prefetchTicks = 0;
+	u64 runTicks = svcGetSystemTick() - _startTick_;
+
+
+	for(auto& it : _rows_)
+	{
+		// File names on the SD card may contain quotes
+		csv += csvQuote(it.name);
+		snprintf(line, sizeof(line), ",%016llX,%u,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%u,%u\n",
+		         (unsigned long long)it.titleID, it.version, (unsigned long long)it.stats.bytes, ticksToMs(it.stats.readTicks), ticksToMs(it.stats.writeTicks),
+		         ticksToMs(it.stats.finishTicks), ticksToMs(it.firmTicks), ticksToMs(it.stats.prefetchTicks),
+		         ticksToMs(it.totalTicks), throughput(it.stats.bytes, it.totalTicks), (unsigned int)it.stats.verifiedContents, (unsigned int)it.stats.skippedContents);
+		csv += line;
+
+		bytes += it.stats.bytes;
+		readTicks += it.stats.readTicks;
+		writeTicks += it.stats.writeTicks;
+		finishTicks += it.stats.finishTicks;
+		firmTicks += it.firmTicks;
+		prefetchTicks += it.stats.prefetchTicks;
+	}
+
+	// The run summary uses the wall clock time of the whole run including the scan
+	snprintf(line, sizeof(line), "\"%s (%u titles)\",,,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%u,%u\n", (complete ? "run" : "failed run"),
+	         (unsigned int)_rows_.size(), (unsigned long long)bytes, ticksToMs(readTicks), ticksToMs(writeTicks), ticksToMs(finishTicks),
+	         ticksToMs(firmTicks), ticksToMs(prefetchTicks), ticksToMs(runTicks), throughput(bytes, runTicks),
+	         (unsigned int)verifiedContents(), (unsigned int)skippedContents());
+	csv += line;
+
+	try
+	{
+		fs::File report(path, FS_OPEN_WRITE|FS_OPEN_CREATE);
+		report.setSize(0);
+		report.setWriteMode(FS_FLUSH_ON_CLOSE);
+		report.write(csv.c_str(), csv.size());
+	} catch(fsException& e) {} // The report is only informational
+}
+
+
+u32 InstallReport::verifiedContents() const
+{
+	u32 count = 0;
+
+	for(auto& it : _rows_) count += it.stats.verifiedContents;
+	return count;
+}
+
+
+u32 InstallReport::skippedContents() const
+{
+	u32 count = 0;
+
+	for(auto& it : _rows_) count += it.stats.skippedContents;
+	return count;
+}
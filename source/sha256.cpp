@@ -0,0 +1,123 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstring>
+#include <3ds.h>
+#include "sha256.h"
+
+#define ROR(x, n)  (((x)>>(n)) | ((x)<<(32 - (n))))
+
+
+
+static const u32 k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+
+
+void Sha256::reset()
+{
+	static const u32 init[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+	memcpy(_state_, init, 32);
+	_blockLen_ = 0;
+	_totalLen_ = 0;
+}
+
+
+void Sha256::transform(const u8 *data)
+{
+	u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+
+
+	for(u32 i=0; i<16; i++) w[i] = (u32)data[i*4]<<24 | (u32)data[i*4+1]<<16 | (u32)data[i*4+2]<<8 | data[i*4+3];
+	for(u32 i=16; i<64; i++)
+	{
+		w[i] = (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2]>>10)) + w[i-7] +
+		       (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15]>>3)) + w[i-16];
+	}
+
+	a = _state_[0]; b = _state_[1]; c = _state_[2]; d = _state_[3];
+	e = _state_[4]; f = _state_[5]; g = _state_[6]; h = _state_[7];
+
+	for(u32 i=0; i<64; i++)
+	{
+		t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	_state_[0] += a; _state_[1] += b; _state_[2] += c; _state_[3] += d;
+	_state_[4] += e; _state_[5] += f; _state_[6] += g; _state_[7] += h;
+}
+
+
+void Sha256::update(const void *data, u32 size)
+{
+	const u8 *ptr = (const u8*)data;
+
+
+	_totalLen_ += size;
+
+	if(_blockLen_)
+	{
+		u32 n = ((64 - _blockLen_<size) ? 64 - _blockLen_ : size);
+
+		memcpy(&_block_[_blockLen_], ptr, n);
+		_blockLen_ += n; ptr += n; size -= n;
+		if(_blockLen_<64) return;
+
+		transform(_block_);
+		_blockLen_ = 0;
+	}
+
+	// Hash full blocks straight from the caller's buffer
+	for(; size>=64; ptr += 64, size -= 64) transform(ptr);
+
+	memcpy(_block_, ptr, size);
+	_blockLen_ = size;
+}
+
+
+void Sha256::finish(u8 *hash)
+{
+	u64 bits = _totalLen_ * 8;
+	u8 pad[72] = {0x80};
+	u32 padLen = ((_blockLen_<56) ? 56 - _blockLen_ : 120 - _blockLen_);
+
+
+	for(u32 i=0; i<8; i++) pad[padLen + i] = bits>>(56 - i*8);
+	update(pad, padLen + 8);
+
+	for(u32 i=0; i<8; i++)
+	{
+		hash[i*4]   = _state_[i]>>24;
+		hash[i*4+1] = _state_[i]>>16;
+		hash[i*4+2] = _state_[i]>>8;
+		hash[i*4+3] = _state_[i];
+	}
+}
@@ -17,10 +17,13 @@
  */
 
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstring>
 #include <3ds.h>
+#include "compress.h"
+#include "error.h"
 #include "fs.h"
 #include "misc.h"
 #include "title.h"
@@ -29,6 +32,21 @@
 
 
 
+// Size of the signature including type and padding in tickets and TMDs. 0 if unknown.
+u32 getSignatureSize(u32 sigType)
+{
+	switch(sigType)
+	{
+		case 0x10000: return 4 + 0x200 + 0x3C; // RSA 4096
+		case 0x10001: return 4 + 0x100 + 0x3C; // RSA 2048
+		case 0x10002: return 4 + 0x3C + 0x40;  // ECDSA
+	}
+
+	return 0;
+}
+
+
+
 std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 {
 	char tmpStr[16];
@@ -84,45 +102,320 @@ std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 }
 
 
-void installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+//===============================================
+// class CiaVerifier                           ||
+//===============================================
+
+void CiaVerifier::parseHeader()
 {
-	fs::File ciaFile(path, FS_OPEN_READ), cia;
-	Buffer<u8> buffer(MAX_BUF_SIZE, false);
-	Handle ciaHandle;
-	u32 blockSize;
-	u64 ciaSize, offset = 0;
-	Result res;
+	u32 headerSize, certSize, ticketSize, tmdSize;
+
+
+	memcpy(&headerSize, &_header_[0x00], 4);
+	memcpy(&certSize,   &_header_[0x08], 4);
+	memcpy(&ticketSize, &_header_[0x0C], 4);
+	memcpy(&tmdSize,    &_header_[0x10], 4);
+
+	// Not a CIA we understand. Leave the judgement to AM.
+	if(headerSize != CIA_HEADER_SIZE || tmdSize>CIA_MAX_TMD_SIZE) {_state_ = STATE_DONE; return;}
+
+	_tmdOffset_ = CIA_ALIGN(CIA_ALIGN(CIA_ALIGN(headerSize) + certSize) + ticketSize);
+	_contentOffset_ = CIA_ALIGN(_tmdOffset_ + tmdSize);
+	_tmd_.resize(tmdSize);
+	_state_ = STATE_TMD;
+}
+
 
+void CiaVerifier::parseTmd()
+{
+	u32 sigSize = getSignatureSize(getBe32(&_tmd_[0]));
+	u32 count, chunkOffset;
 
 
-	ciaSize = ciaFile.size();
-	if((res = AM_StartCiaInstall(mediaType, &ciaHandle))) throw titleException(_FILE_, __LINE__, res, "Failed to start CIA installation!");
-	cia.setFileHandle(ciaHandle); // Use the handle returned by AM
+	_state_ = STATE_DONE;
+	if(!sigSize || _tmd_.size()<sigSize + TMD_HEADER_SIZE) return;
 
+	_titleID_ = getBe64(&_tmd_[sigSize + 0x4C]);
+	_version_ = getBe16(&_tmd_[sigSize + 0x9C]);
+	count = getBe16(&_tmd_[sigSize + 0x9E]);
+	chunkOffset = sigSize + TMD_HEADER_SIZE; // Skip header and content info records
+	if(_tmd_.size()<chunkOffset + count * 0x30) return;
 
-	for(u32 i=0; i<=ciaSize / MAX_BUF_SIZE; i++)
+	for(u32 i=0; i<count; i++)
 	{
-		blockSize = ((ciaSize - offset<MAX_BUF_SIZE) ? ciaSize - offset : MAX_BUF_SIZE);
+		const u8 *chunk = &_tmd_[chunkOffset + i * 0x30];
+		u16 index = getBe16(&chunk[4]);
+		Content content;
+
+		// Only contents set in the content index are in the CIA
+		if(!(_header_[0x20 + index / 8] & (0x80>>(index % 8)))) continue;
+
+		content.size = getBe64(&chunk[8]);
+		_titleSize_ += content.size;
+		content.encrypted = getBe16(&chunk[6]) & 1;
+		memcpy(content.hash, &chunk[0x10], SHA256_HASH_SIZE);
+		_contents_.push_back(content);
+	}
 
-		if(blockSize>0)
+	_tmd_.clear(); _tmd_.shrink_to_fit();
+	_tmdParsed_ = true;
+	_curContent_ = 0;
+	if(_contents_.size())
+	{
+		_curLeft_ = _contents_[0].size;
+		_sha_.reset();
+		_state_ = STATE_CONTENT;
+		if(!_curLeft_) nextContent();
+	}
+}
+
+
+// Empty contents are checked right away. No data may follow the last one.
+void CiaVerifier::nextContent()
+{
+	do
+	{
+		Content& content = _contents_[_curContent_];
+
+		if(content.encrypted) _skipped_++;
+		else
 		{
-			try
-			{
-				ciaFile.read(&buffer, blockSize);
-				cia.write(&buffer, blockSize);
-			} catch(fsException& e)
-			{
-				AM_CancelCIAInstall(ciaHandle); // Abort installation
-				cia.setFileHandle(0); // Reset the handle so it doesn't get closed twice
-				throw;
-			}
+			u8 hash[SHA256_HASH_SIZE];
 
-			offset += blockSize;
-			if(callback) callback(path, offset * 100 / ciaSize);
+			_sha_.finish(hash);
+			if(memcmp(hash, content.hash, SHA256_HASH_SIZE)) {_failed_ = true; _state_ = STATE_DONE; return;}
+			_verified_++;
 		}
+
+		if(++_curContent_ == _contents_.size()) {_state_ = STATE_DONE; return;}
+
+		_curLeft_ = _contents_[_curContent_].size;
+		_sha_.reset();
+	} while(!_curLeft_);
+}
+
+
+void CiaVerifier::feed(const u8 *data, u32 size)
+{
+	u64 startTick = svcGetSystemTick();
+	u32 n;
+
+
+	while(size && _state_ != STATE_DONE)
+	{
+		switch(_state_)
+		{
+			case STATE_HEADER:
+				n = ((CIA_HEADER_SIZE - _pos_<size) ? CIA_HEADER_SIZE - _pos_ : size);
+				memcpy(&_header_[_pos_], data, n);
+				if(_pos_ + n == CIA_HEADER_SIZE) parseHeader();
+				break;
+			case STATE_TMD:
+				if(_pos_<_tmdOffset_) // Skip cert chain and ticket
+				{
+					n = ((_tmdOffset_ - _pos_<size) ? _tmdOffset_ - _pos_ : size);
+					break;
+				}
+				n = ((_tmd_.size() - _tmdFill_<size) ? _tmd_.size() - _tmdFill_ : size);
+				memcpy(&_tmd_[_tmdFill_], data, n);
+				_tmdFill_ += n;
+				if(_tmdFill_ == _tmd_.size()) parseTmd();
+				break;
+			case STATE_CONTENT:
+				if(_pos_<_contentOffset_) // Skip TMD padding
+				{
+					n = ((_contentOffset_ - _pos_<size) ? _contentOffset_ - _pos_ : size);
+					break;
+				}
+				n = ((_curLeft_<size) ? _curLeft_ : size);
+				if(!_contents_[_curContent_].encrypted)
+				{
+					_sha_.update(data, n);
+					_hashedBytes_ += n;
+				}
+				_curLeft_ -= n;
+				if(!_curLeft_) nextContent();
+				break;
+			default:
+				n = size;
+		}
+
+		_pos_ += n;
+		data += n;
+		size -= n;
+	}
+
+	_hashTicks_ += svcGetSystemTick() - startTick;
+}
+
+
+void CiaVerifier::getTitleEntry(AM_TitleEntry& entry)
+{
+	memset(&entry, 0, sizeof(AM_TitleEntry));
+	entry.titleID = _titleID_;
+	entry.size    = _titleSize_;
+	entry.version = _version_;
+}
+
+
+//===============================================
+// class CiaInstaller                          ||
+//===============================================
+
+CiaInstaller::CiaInstaller(FS_MediaType mediaType, bool start) : _mediaType_(mediaType)
+{
+	if(start) this->start();
+}
+
+
+void CiaInstaller::start()
+{
+	Handle ciaHandle;
+	Result res;
+
+
+	if(_cia_.getFileHandle()) return;
+	if((res = AM_StartCiaInstall(_mediaType_, &ciaHandle))) throw titleException(_FILE_, __LINE__, res, "Failed to start CIA installation!");
+	_cia_.setFileHandle(ciaHandle); // Use the handle returned by AM
+}
+
+
+void CiaInstaller::write(const u8 *data, u32 size, bool alreadyVerified)
+{
+	if(!alreadyVerified) _verifier_.feed(data, size);
+
+	// The verifier is always ahead of AM so we stop before AM sees the broken content
+	if(_verifier_.failed()) throw titleException(_FILE_, __LINE__, ERR_HASH_MISMATCH, "Content hash mismatch! The CIA is corrupted.");
+
+	u64 startTick = svcGetSystemTick();
+	_cia_.write(data, size);
+	_stats_.writeTicks += svcGetSystemTick() - startTick;
+	_stats_.bytes += size;
+}
+
+
+void CiaInstaller::finish()
+{
+	Handle ciaHandle = _cia_.getFileHandle();
+	Result res;
+
+
+	if(_verifier_.failed()) throw titleException(_FILE_, __LINE__, ERR_HASH_MISMATCH, "Content hash mismatch! The CIA is corrupted.");
+
+	_stats_.verifiedContents = _verifier_.verifiedContents();
+	_stats_.skippedContents = _verifier_.skippedContents();
+
+	u64 startTick = svcGetSystemTick();
+	_finished_ = true;
+	res = AM_FinishCiaInstall(ciaHandle);
+	_stats_.finishTicks = svcGetSystemTick() - startTick;
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to finish CIA installation!");
+}
+
+
+void CiaInstaller::cancel()
+{
+	if(_finished_ || !_cia_.getFileHandle()) return;
+
+	AM_CancelCIAInstall(_cia_.getFileHandle()); // Abort installation
+	_cia_.setFileHandle(0); // Reset the handle so it doesn't get closed twice
+}
+
+
+//===============================================
+// class CiaFile                               ||
+//===============================================
+
+CiaFile::CiaFile(const std::u16string& path, FS_MediaType mediaType, bool prefetch) : _path_(path), _installer_(mediaType, false)
+{
+	CiaVerifier& verifier = _installer_.verifier();
+	tuneKey key = ((mediaType == MEDIATYPE_NAND) ? TUNE_INSTALL_NAND : TUNE_INSTALL_SD);
+
+
+	// The reader thread also hashes every block so the hashes are done while AM is busy.
+	// Compressed data can only be hashed after decompressing it on the installing thread.
+	if(isCompressed(path)) _source_ = decompressIfNeeded(std::unique_ptr<ByteSource>(new FileSource(path, key, nullptr, !prefetch)), path);
+	else _source_.reset(new FileSource(path, key, [&verifier](const u8 *data, u32 size) {verifier.feed(data, size);}, !prefetch));
+}
+
+
+InstallStats CiaFile::install(std::function<void (const std::u16string& file, u32 percent)> callback, std::function<void ()> streamed)
+{
+	return installCia(*_source_, _installer_, _path_, callback, streamed);
+}
+
+
+//===============================================
+// Title functions                             ||
+//===============================================
+
+AM_TitleEntry getCiaFileInfo(const std::u16string& path, FS_MediaType mediaType)
+{
+	fs::File ciaFile(path, FS_OPEN_READ);
+	AM_TitleEntry entry;
+	Result res;
+
+
+
+	std::unique_ptr<Decompressor> decompressor(createDecompressor(path));
+	if(!decompressor)
+	{
+		if((res = AM_GetCiaFileInfo(mediaType, &entry, ciaFile.getFileHandle()))) throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
+		return entry;
 	}
 
-	if((res = AM_FinishCiaInstall(ciaHandle))) throw titleException(_FILE_, __LINE__, res, "Failed to finish CIA installation!");
+
+	// AM can't read compressed CIAs. Decompress until we have the TMD.
+	CiaVerifier verifier;
+	Buffer<u8> buffer(0x10000, false);
+	u32 bytesRead;
+
+	while(!verifier.tmdParsed() && (bytesRead = ciaFile.read(&buffer, buffer.size())))
+	{
+		decompressor->feed(&buffer, bytesRead, [&verifier](const u8 *data, u32 size) {verifier.feed(data, size);});
+	}
+	if(!verifier.tmdParsed()) throw titleException(_FILE_, __LINE__, ERR_BAD_COMPRESSED, "Failed to find the TMD in the compressed CIA!");
+
+	verifier.getTitleEntry(entry);
+	return entry;
+}
+
+
+InstallStats installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	return CiaFile(path, mediaType).install(callback);
+}
+
+
+InstallStats installCia(ByteSource& source, CiaInstaller& installer, const std::u16string& name, std::function<void (const std::u16string& file, u32 percent)> callback, std::function<void ()> streamed)
+{
+	InstallStats& stats = installer.stats();
+	u64 size = source.size();
+
+
+
+	installer.start();
+
+	source.stream([&](const u8 *data, u32 blockSize)
+	{
+		installer.write(data, blockSize, source.verified());
+		if(callback && size) callback(name, source.position() * 100 / size);
+	});
+
+	stats.readTicks += source.readTicks();
+	stats.prefetchTicks += source.prefetchTicks();
+	if(streamed) streamed();
+
+	installer.finish();
+	return stats;
+}
+
+
+InstallStats installCia(ByteSource& source, FS_MediaType mediaType, const std::u16string& name, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	CiaInstaller installer(mediaType);
+
+	return installCia(source, installer, name, callback);
 }
 
 
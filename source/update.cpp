@@ -0,0 +1,358 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "batch.h"
+#include "bundle.h"
+#include "cdn.h"
+#include "compress.h"
+#include "error.h"
+#include "fs.h"
+#include "misc.h"
+#include "report.h"
+#include "thread.h"
+#include "title.h"
+#include "update.h"
+
+#define _FILE_ "update.cpp" // Replacement for __FILE__ without the path
+#define UPDATES_ZIP_PATH u"/updates/updates.zip"
+#define INSTALL_THREADS     (3)       // AM install handles open at once for independent titles
+#define INSTALL_STACK_SIZE  (0x10000) // CiaInstaller alone needs more than 8 KB
+#define FIRST_DATA_PRIORITY (4)       // Index of the first system data archive type in titleTypes
+
+typedef struct
+{
+	std::u16string name;
+	AM_TitleEntry entry;
+	bool requiresDelete;
+	const BundleEntry *bundleEntry; // nullptr if the CIA is not in the ZIP
+	CdnTitle *cdnTitle;             // nullptr if the title is not in CDN layout
+	StagedCia *stagedCia;           // nullptr if the CIA is not in RAM
+} TitleInstallInfo;
+
+// Ordered from highest to lowest priority.
+static const u32 titleTypes[7] = {
+		0x00040138, // System Firmware
+		0x00040130, // System Modules
+		0x00040030, // Applets
+		0x00040010, // System Applications
+		0x0004001B, // System Data Archives
+		0x0004009B, // System Data Archives (Shared Archives)
+		0x000400DB, // System Data Archives
+};
+
+u32 getTitlePriority(u64 id) {
+	u32 type = (u32) (id >> 32);
+	for(u32 i = 0; i < 7; i++) {
+		if(type == titleTypes[i]) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+bool sortTitlesHighToLow(const TitleInstallInfo &a, const TitleInstallInfo &b) {
+	bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
+	bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
+	if(aSafe != bSafe) {
+		return aSafe;
+	}
+
+	return getTitlePriority(a.entry.titleID) < getTitlePriority(b.entry.titleID);
+}
+
+bool sortTitlesLowToHigh(const TitleInstallInfo &a, const TitleInstallInfo &b) {
+        bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
+        bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
+        if(aSafe != bSafe) {
+                return aSafe;
+        }
+
+	return getTitlePriority(a.entry.titleID) > getTitlePriority(b.entry.titleID);
+}
+
+// Find title and compare versions. Returns CIA file version - installed title version
+int versionCmp(std::vector<TitleInfo>& installedTitles, u64 titleID, u16 version)
+{
+	for(auto it : installedTitles)
+	{
+		if(it.titleID == titleID)
+		{
+			return (version - it.version);
+		}
+	}
+
+	return 1; // The title is not installed
+}
+
+
+// System data archives don't depend on anything so they can be installed
+// side by side. minizip can only read one ZIP entry at a time.
+static bool isIndependent(const TitleInstallInfo& info)
+{
+	return getTitlePriority(info.entry.titleID) >= FIRST_DATA_PRIORITY && !info.bundleEntry;
+}
+
+
+// Returns the end of the run of independent titles starting at first. The run
+// ends where the sort order changes to something else so everything before
+// and after it stays strictly ordered.
+static size_t independentRunEnd(const std::vector<TitleInstallInfo>& titles, size_t first)
+{
+	size_t end = first;
+	bool safe = (titles[first].entry.titleID & 0xFF) == 0x03;
+
+	while(end < titles.size() && isIndependent(titles[end]) && ((titles[end].entry.titleID & 0xFF) == 0x03) == safe) end++;
+	return end;
+}
+
+
+static void printTitleName(const TitleInstallInfo& info)
+{
+	Buffer<char> tmpStr(256);
+
+	if(info.entry.titleID == 0x0004013800000002LL || info.entry.titleID == 0x0004013820000002LL)
+	{
+		printf("NATIVE_FIRM         ");
+	} else
+	{
+		utf16_to_utf8((u8*) &tmpStr, (u16*) info.name.c_str(), 255);
+
+		printf("%s", &tmpStr);
+	}
+}
+
+
+// Installs one title from wherever it is stored. cia may hold the
+// already opened CIA file. Anything but the firm install is done here.
+static InstallStats installTitle(const TitleInstallInfo& info, CiaBundle *bundle, CiaBatch& batch, std::unique_ptr<CiaFile> cia, std::function<void ()> streamed)
+{
+	if(info.requiresDelete) deleteTitle(MEDIATYPE_NAND, info.entry.titleID);
+	if(info.bundleEntry) return bundle->install(*info.bundleEntry, MEDIATYPE_NAND);
+	if(info.cdnTitle) return info.cdnTitle->install(MEDIATYPE_NAND);
+	if(info.stagedCia) return batch.install(info.stagedCia, MEDIATYPE_NAND);
+
+	if(!cia) cia.reset(new CiaFile(u"/updates/" + info.name, MEDIATYPE_NAND));
+	return cia->install(nullptr, streamed);
+}
+
+
+// Installs titles[first] to titles[last - 1] with up to INSTALL_THREADS
+// AM install handles at once and returns when all of them are done.
+// After an error no new title is started and the first error is rethrown.
+static void installConcurrently(const std::vector<TitleInstallInfo>& titles, size_t first, size_t last, CiaBundle *bundle, CiaBatch& batch, InstallReport& report)
+{
+	Mutex lock;
+	size_t next = first;
+	std::unique_ptr<fsException> fsError;
+	std::unique_ptr<titleException> titleError;
+	std::exception_ptr otherError;
+	std::vector<std::unique_ptr<WorkerThread>> workers;
+
+
+	auto worker = [&]()
+	{
+		while(1)
+		{
+			size_t i;
+			{
+				LockGuard guard(lock);
+				if(next >= last || fsError || titleError || otherError) return;
+				i = next++;
+			}
+
+			u64 startTick = svcGetSystemTick();
+			try
+			{
+				InstallStats stats = installTitle(titles[i], bundle, batch, nullptr, nullptr);
+
+				LockGuard guard(lock);
+				printTitleName(titles[i]);
+				printf("\x1b[32m  Installed\x1b[0m\n");
+				report.add(titles[i].name, titles[i].entry, stats, 0, svcGetSystemTick() - startTick);
+			}
+			catch(fsException& e) {LockGuard guard(lock); if(!fsError && !titleError && !otherError) fsError.reset(new fsException(e));}
+			catch(titleException& e) {LockGuard guard(lock); if(!fsError && !titleError && !otherError) titleError.reset(new titleException(e));}
+			catch(...) {LockGuard guard(lock); if(!fsError && !titleError && !otherError) otherError = std::current_exception();}
+		}
+	};
+
+	// This thread is one of the workers. If no thread can be created it does everything alone.
+	for(size_t i = 1; i < INSTALL_THREADS && i < last - first; i++)
+	{
+		workers.emplace_back(new WorkerThread(worker, -2, INSTALL_STACK_SIZE));
+		if(!workers.back()->started()) {workers.pop_back(); break;}
+	}
+	worker();
+	workers.clear(); // Joins all of them
+
+	if(fsError) throw *fsError;
+	if(titleError) throw *titleError;
+	if(otherError) std::rethrow_exception(otherError);
+}
+
+
+void installUpdates(bool downgrade)
+{
+	InstallReport report; // First so the run time includes the scan
+	std::vector<TitleInfo> installedTitles = getTitleInfos(MEDIATYPE_NAND);
+	std::vector<TitleInstallInfo> titles;
+	std::unique_ptr<CiaBundle> bundle;
+	std::vector<std::unique_ptr<CdnTitle>> cdnTitles;
+	CiaBatch batch;
+	StagedCia *stagedCia;
+
+	Result res;
+	TitleInstallInfo installInfo;
+	AM_TitleEntry ciaFileInfo;
+
+	printf("Getting CIA file informations...\n\n");
+
+	// Filter for .cia files and compressed ones. Skip the attribute files OSX creates.
+	for(auto& it : fs::DirStream(u"/updates", fs::NameFilter(CIA_NAME_FILTER u"!.*;")))
+	{
+		stagedCia = nullptr;
+
+		if(it.isDir)
+		{
+			// Titles in CDN layout are assembled to CIAs on the fly
+			if(!CdnTitle::isCdnDir(u"/updates/" + it.name)) continue;
+
+			cdnTitles.emplace_back(new CdnTitle(u"/updates/" + it.name));
+			ciaFileInfo = cdnTitles.back()->info();
+		}
+		else
+		{
+			// Small CIAs are read into RAM right away and installed from there
+			if((stagedCia = batch.stage(u"/updates/" + it.name, it.size))) ciaFileInfo = stagedCia->info;
+			else ciaFileInfo = getCiaFileInfo(u"/updates/" + it.name, MEDIATYPE_NAND);
+		}
+
+		int cmpResult = versionCmp(installedTitles, ciaFileInfo.titleID, ciaFileInfo.version);
+		if((downgrade && cmpResult != 0) || (cmpResult > 0))
+		{
+			installInfo.name = it.name;
+			installInfo.entry = ciaFileInfo;
+			installInfo.requiresDelete = downgrade && cmpResult < 0;
+			installInfo.bundleEntry = nullptr;
+			installInfo.cdnTitle = (it.isDir ? cdnTitles.back().get() : nullptr);
+			installInfo.stagedCia = stagedCia;
+
+			titles.push_back(installInfo);
+		}
+		else if(stagedCia) batch.release(stagedCia); // Up to date. Make room for the next ones.
+	}
+
+	// CIAs in the ZIP are installed without extracting them first
+	if(fs::fileExist(UPDATES_ZIP_PATH))
+	{
+		bundle.reset(new CiaBundle(UPDATES_ZIP_PATH));
+
+		for(auto& it : bundle->entries())
+		{
+			int cmpResult = versionCmp(installedTitles, it.info.titleID, it.info.version);
+			if((downgrade && cmpResult != 0) || (cmpResult > 0))
+			{
+				installInfo.name = it.name;
+				installInfo.entry = it.info;
+				installInfo.requiresDelete = downgrade && cmpResult < 0;
+				installInfo.bundleEntry = &it;
+				installInfo.cdnTitle = nullptr;
+				installInfo.stagedCia = nullptr;
+
+				titles.push_back(installInfo);
+			}
+		}
+	}
+
+	std::sort(titles.begin(), titles.end(), downgrade ? sortTitlesLowToHigh : sortTitlesHighToLow);
+
+	std::unique_ptr<CiaFile> nextCia;
+	u64 savedTicks = 0;
+
+	try
+	{
+		for(size_t i = 0; i < titles.size(); i++)
+		{
+			const TitleInstallInfo& it = titles[i];
+			u64 startTick = svcGetSystemTick(), firmTicks = 0;
+			InstallStats stats;
+
+			// Runs of independent titles are installed side by side
+			size_t runEnd = independentRunEnd(titles, i);
+			if(runEnd - i > 1)
+			{
+				installConcurrently(titles, i, runEnd, bundle.get(), batch, report);
+				i = runEnd - 1;
+				continue;
+			}
+
+			// Start reading the next CIA while AM finalizes this title.
+			// Only reading is overlapped so the install order stays the same.
+			auto prefetchNext = [&]()
+			{
+				if(nextCia || i + 1 >= titles.size()) return;
+
+				const TitleInstallInfo& next = titles[i + 1];
+				if(next.bundleEntry || next.cdnTitle || next.stagedCia) return;
+				if(independentRunEnd(titles, i + 1) - (i + 1) > 1) return; // Installed concurrently
+
+				// Errors show up again when the title is installed
+				try {nextCia.reset(new CiaFile(u"/updates/" + next.name, MEDIATYPE_NAND, true));}
+				catch(fsException& e) {}
+				catch(titleException& e) {}
+			};
+
+			bool nativeFirm = it.entry.titleID == 0x0004013800000002LL || it.entry.titleID == 0x0004013820000002LL;
+			printTitleName(it);
+
+			stats = installTitle(it, bundle.get(), batch, std::move(nextCia), prefetchNext);
+			prefetchNext(); // Still overlaps AM_InstallFirm for titles not installed with CiaFile
+			if(nativeFirm)
+			{
+				firmTicks = svcGetSystemTick();
+				if((res = AM_InstallFirm(it.entry.titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to install NATIVE_FIRM!");
+				firmTicks = svcGetSystemTick() - firmTicks;
+			}
+			printf("\x1b[32m  Installed\x1b[0m");
+			if(stats.prefetchTicks) printf(" (prefetch saved %ums)", (unsigned int)(stats.prefetchTicks / TICKS_PER_MSEC));
+			printf("\n");
+
+			report.add(it.name, it.entry, stats, firmTicks, svcGetSystemTick() - startTick);
+			savedTicks += stats.prefetchTicks;
+		}
+	} catch(...)
+	{
+		report.save(false);
+		throw;
+	}
+
+	report.save(true);
+	if(savedTicks) printf("\nReading ahead saved %ums.\n", (unsigned int)(savedTicks / TICKS_PER_MSEC));
+	// Encrypted contents are installed unchecked
+	printf("\n%u contents verified", (unsigned int)report.verifiedContents());
+	if(report.skippedContents()) printf(", %u encrypted ones unchecked", (unsigned int)report.skippedContents());
+	printf(".\n");
+}
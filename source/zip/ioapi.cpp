@@ -13,7 +13,7 @@
 #include <string>
 #include "fs.h"
 
-fs::File _zipFile_;
+fs::BufferedFile _zipFile_; // unzip reads headers a few bytes at a time
 
 
 #if defined(_WIN32) && (!(defined(_CRT_SECURE_NO_WARNINGS)))
@@ -129,7 +129,12 @@ static voidpf ZCALLBACK fopen64_file_func (voidpf opaque, const void* filename,
         mode_fopen = FS_OPEN_READ|FS_OPEN_WRITE|FS_OPEN_CREATE;
 
     if ((filename!=NULL))
+    {
         FOPEN_FUNC(filename, mode_fopen);
+        // The zip writer writes headers a few bytes at a time
+        if (mode_fopen & FS_OPEN_WRITE) _zipFile_.setWriteMode(FS_FLUSH_ON_CLOSE, BUFFERED_FILE_WINDOW);
+        else _zipFile_.setWriteMode(FS_FLUSH_ALWAYS);
+    }
     return ((FILE*)0x1); // dummy
 }
 
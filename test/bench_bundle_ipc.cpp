@@ -0,0 +1,139 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// IPC round trips for scanning updates.zip. minizip reads the headers a
+// few bytes at a time. The same scan CiaBundle does runs once on a plain
+// fs::File, where every read is a FSFILE_Read, and once on a BufferedFile.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <3ds.h>
+#include "bundle.h"
+#include "common.h"
+#include "fs.h"
+#include "title.h"
+#include "unzip.h"
+
+
+
+#define CIA_COUNT  (100)
+
+
+
+// minizip callbacks on top of any file class with the fs::File interface
+template<class F> struct ZipIo
+{
+	static voidpf ZCALLBACK open(voidpf opaque, const void *filename, int mode)
+	{
+		F *file = new F;
+		file->open((const char16_t*)filename, FS_OPEN_READ);
+		return file;
+	}
+	static uLong ZCALLBACK read(voidpf opaque, voidpf stream, void *buf, uLong size) {return ((F*)stream)->read(buf, size);}
+	static uLong ZCALLBACK write(voidpf opaque, voidpf stream, const void *buf, uLong size) {return 0;}
+	static ZPOS64_T ZCALLBACK tell(voidpf opaque, voidpf stream) {return ((F*)stream)->tell();}
+	static long ZCALLBACK seek(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+	{
+		((F*)stream)->seek(offset, (fsSeekMode)origin);
+		return 0;
+	}
+	static int ZCALLBACK close(voidpf opaque, voidpf stream) {delete (F*)stream; return 0;}
+	static int ZCALLBACK error(voidpf opaque, voidpf stream) {return 0;}
+};
+
+
+// What CiaBundle does: list the entries and read every CIA up to its TMD
+template<class F> static u32 scanZip(const std::u16string& path)
+{
+	zlib_filefunc64_def io = {ZipIo<F>::open, ZipIo<F>::read, ZipIo<F>::write, ZipIo<F>::tell, ZipIo<F>::seek, ZipIo<F>::close, ZipIo<F>::error, nullptr};
+	unzFile zip = unzOpen2_64(path.c_str(), &io);
+	unz_file_info64 info;
+	unz64_file_pos pos;
+	std::vector<u8> buf(0x4000);
+	char name[256];
+	u32 count = 0;
+	int res;
+
+
+	if(!zip) return 0;
+	for(res = unzGoToFirstFile(zip); res == UNZ_OK; res = unzGoToNextFile(zip))
+	{
+		CiaVerifier verifier;
+		int bytesRead;
+
+		unzGetCurrentFileInfo64(zip, &info, name, sizeof(name), nullptr, 0, nullptr, 0);
+		unzGetFilePos64(zip, &pos);
+		unzGoToFilePos64(zip, &pos);
+		if(unzOpenCurrentFile(zip) != UNZ_OK) break;
+		while(!verifier.tmdParsed() && (bytesRead = unzReadCurrentFile(zip, buf.data(), buf.size())) > 0) verifier.feed(buf.data(), bytesRead);
+		unzCloseCurrentFile(zip);
+		count += verifier.tmdParsed();
+	}
+	unzClose(zip);
+
+	return count;
+}
+
+
+int main()
+{
+	TestSd sd;
+	std::vector<std::pair<std::string, std::vector<u8>>> files;
+	char name[32];
+
+
+	for(u32 i = 0; i < CIA_COUNT; i++)
+	{
+		snprintf(name, sizeof(name), "title_%03u.cia", (unsigned int)i);
+		files.emplace_back(name, makeCia(0x0004001B00010002LL + ((u64)i<<8), 0x400, {0x8000}, i));
+	}
+	sd.makeDir("/updates");
+	sd.writeFile("/updates/updates.zip", makeZip(files));
+
+	try
+	{
+		ctrHost::resetIpcCount();
+		u32 plainCount = scanZip<fs::File>(u"/updates/updates.zip");
+		u64 plainIpc = ctrHost::ipcCount();
+
+		ctrHost::resetIpcCount();
+		u32 bufferedCount = scanZip<fs::BufferedFile>(u"/updates/updates.zip");
+		u64 bufferedIpc = ctrHost::ipcCount();
+
+		ctrHost::resetIpcCount();
+		CiaBundle bundle(u"/updates/updates.zip");
+		u64 bundleIpc = ctrHost::ipcCount();
+
+		printf("%u CIAs in updates.zip\n", CIA_COUNT);
+		printf("fs::File:        %6llu IPC\n", (unsigned long long)plainIpc);
+		printf("fs::BufferedFile: %5llu IPC  %.1fx fewer\n", (unsigned long long)bufferedIpc, (double)plainIpc / bufferedIpc);
+		printf("CiaBundle:       %6llu IPC\n", (unsigned long long)bundleIpc);
+
+		CHECK(plainCount == CIA_COUNT && bufferedCount == CIA_COUNT);
+		CHECK(bundle.entries().size() == CIA_COUNT);
+		CHECK(bufferedIpc * 10 < plainIpc);
+		CHECK(bundleIpc * 10 < plainIpc);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
@@ -0,0 +1,126 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Empties the root like deleteDir("/") did before deleteTree(): one
+// recursive delete per top-level dir and one delete per file on this
+// thread. Then deleteDir("/") with the workers of the Old 3DS (2) and the
+// New 3DS (4). A recursive delete costs a metadata update per object it
+// removes, so the workers win by doing those side by side.
+
+#include <cstdio>
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+#define TREE_COUNT      (3)
+#define DIRS_PER_TREE   (12)
+#define FILES_PER_DIR   (20)
+#define ROOT_FILES      (7)
+
+
+
+// Returns the number of objects made
+static u32 makeRoot(TestSd& sd)
+{
+	u32 objects = ROOT_FILES;
+
+
+	for(u32 i = 0; i < ROOT_FILES; i++) sd.writeFile("/root" + std::to_string(i) + ".bin", testData(0x100, i));
+	for(u32 tree = 0; tree < TREE_COUNT; tree++)
+	{
+		const std::string treeDir = "/tree" + std::to_string(tree);
+
+		sd.makeDir(treeDir);
+		objects++;
+		for(u32 dir = 0; dir < DIRS_PER_TREE; dir++)
+		{
+			const std::string path = treeDir + "/d" + std::to_string(dir / 4) + "/e" + std::to_string(dir % 4);
+
+			sd.makeDir(path);
+			objects += (dir % 4 ? 1 : 2);
+			for(u32 file = 0; file < FILES_PER_DIR; file++) sd.writeFile(path + "/f" + std::to_string(file) + ".bin", testData(0x100, file));
+			objects += FILES_PER_DIR;
+		}
+	}
+	fs::clearDirCache();
+
+	return objects;
+}
+
+
+static void deleteRootSerially()
+{
+	fs::DirWalker walker(u"/");
+	fs::DirWalker::Event event;
+
+	while((event = walker.next()) != fs::DirWalker::WALK_END)
+	{
+		if(event == fs::DirWalker::WALK_DIR)
+		{
+			fs::deleteDir(walker.path());
+			walker.skip();
+		}
+		else if(event == fs::DirWalker::WALK_FILE) fs::deleteFile(walker.path());
+	}
+}
+
+
+int main()
+{
+	TestSd sd;
+	ctrHost::Config& config = ctrHost::config();
+	u32 objects;
+
+
+	config.openUs    = 1000;
+	config.dirReadUs = 1000;
+	config.metaUs    = 1000;
+
+	try
+	{
+		objects = makeRoot(sd);
+		printf("%u objects in root, 1 ms per delete and per dir call\n", objects);
+
+		u64 startTick = svcGetSystemTick();
+		deleteRootSerially();
+		const double serialMs = ticksToMs(svcGetSystemTick() - startTick);
+		printf("one by one:         %7.1f ms  %6.0f objects/s\n", serialMs, objects * 1000.0 / serialMs);
+		CHECK(fs::listDirContents(u"/").empty());
+
+		for(int new3ds = 0; new3ds < 2; new3ds++)
+		{
+			config.new3ds = new3ds;
+			CHECK(makeRoot(sd) == objects);
+
+			fs::DeleteStats stats = fs::deleteDir(u"/");
+			const double ms = ticksToMs(stats.ticks);
+			printf("deleteDir(\"/\") (%u):  %7.1f ms  %6u objects/s  speedup %.2fx\n", (new3ds ? COPY_WORKERS_NEW3DS : COPY_WORKERS_OLD3DS),
+			       ms, stats.objectsPerSec(), serialMs / ms);
+			CHECK(stats.fileCount + stats.dirCount == objects);
+			CHECK(fs::listDirContents(u"/").empty() && !sd.exists("/tree0"));
+			CHECK(ms < serialMs);
+		}
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
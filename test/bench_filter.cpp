@@ -0,0 +1,137 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Filtering a dir of 10k entries. The old listDirContents() loop split the
+// filter string with find_first_of() and copied every name into a
+// std::u16string. NameFilter is compiled once and matches the raw names.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+#define ENTRY_COUNT  (10000)
+#define ROUNDS       (20)
+
+
+
+// The matcher of the old listDirContents(). Case sensitive, no excludes.
+static bool oldMatch(const std::u16string& filter, const u16 *name, bool isDir)
+{
+	if(isDir) return true;
+
+	size_t foundOld = 0;
+	size_t found = 0;
+	const std::u16string file((const char16_t*)name);
+
+	while(1)
+	{
+		found = filter.find_first_of(u";", found+1);
+		if(found == std::u16string::npos) break;
+		if(foundOld > 0) foundOld++; // Skip the separator
+		if(file.length() < found-foundOld) continue;
+		if(file.compare(file.length()-(found-foundOld), found-foundOld, filter, foundOld, found-foundOld) == 0) return true;
+		foundOld = found;
+	}
+
+	return false;
+}
+
+
+int main()
+{
+	static const char *suffixes[] = {".cia", ".CIA", ".cia.lz4", ".txt", ".bin", ".Cia.LZ4", ".tmd", ".cia.bak"};
+	std::vector<FS_DirectoryEntry> entries(ENTRY_COUNT);
+	u32 expected = 0, x = 1;
+	char name[64];
+
+
+	for(u32 i = 0; i < ENTRY_COUNT; i++)
+	{
+		x ^= x<<13; x ^= x>>17; x ^= x<<5; // xorshift32
+		const bool isDir = !(x % 16), hidden = !((x>>4) % 32);
+		const u32 suffix = (x>>9) % 8;
+
+		snprintf(name, sizeof(name), "%s%08X%s", (hidden ? "._" : ""), x, (isDir ? "" : suffixes[suffix]));
+		for(u32 j = 0; j <= strlen(name); j++) entries[i].name[j] = name[j];
+		entries[i].attributes = (isDir ? FS_ATTRIBUTE_DIRECTORY : 0);
+		if(!hidden && !isDir && (suffix == 0 || suffix == 1 || suffix == 2 || suffix == 5)) expected++;
+	}
+
+	const std::u16string oldFilter(u".cia;.cia.lz4;");
+	u32 oldMatches = 0;
+	u64 startTick = svcGetSystemTick();
+	for(u32 round = 0; round < ROUNDS; round++)
+	{
+		oldMatches = 0;
+		for(auto& it : entries) oldMatches += oldMatch(oldFilter, it.name, it.attributes & FS_ATTRIBUTE_DIRECTORY);
+	}
+	double oldMs = ticksToMs(svcGetSystemTick() - startTick) / ROUNDS;
+
+	u32 newMatches = 0;
+	startTick = svcGetSystemTick();
+	for(u32 round = 0; round < ROUNDS; round++)
+	{
+		const fs::NameFilter filter(u".cia;.cia.lz4;!.*;");
+
+		newMatches = 0;
+		for(auto& it : entries)
+		{
+			u32 length = 0;
+			while(it.name[length]) length++;
+			newMatches += (!(it.attributes & FS_ATTRIBUTE_DIRECTORY) && filter.match(it.name, length, false));
+		}
+	}
+	double newMs = ticksToMs(svcGetSystemTick() - startTick) / ROUNDS;
+
+	printf("%u entries, %u CIAs in any case\n", ENTRY_COUNT, expected);
+	printf("old matcher:  %6.3f ms  %u matches (case sensitive, hidden files included)\n", oldMs, oldMatches);
+	printf("NameFilter:   %6.3f ms  %u matches  speedup %.1fx\n", newMs, newMatches, oldMs / newMs);
+	CHECK(newMatches == expected);
+	CHECK(oldMatches < expected); // Misses .CIA and .Cia.LZ4
+	CHECK(newMs < oldMs);
+
+	// The same dir on the SD card through DirStream
+	TestSd sd;
+	sd.makeDir("/updates");
+	for(auto& it : entries)
+	{
+		std::string entryName;
+		for(u32 j = 0; it.name[j]; j++) entryName += (char)it.name[j];
+		if(it.attributes & FS_ATTRIBUTE_DIRECTORY) sd.makeDir("/updates/" + entryName);
+		else sd.writeFile("/updates/" + entryName, {});
+	}
+
+	try
+	{
+		u32 listed = 0;
+		startTick = svcGetSystemTick();
+		for(auto& it : fs::DirStream(u"/updates", fs::NameFilter(u".cia;.cia.lz4;!.*;"))) listed += !it.isDir;
+		printf("DirStream:    %6.1f ms  %u files\n", ticksToMs(svcGetSystemTick() - startTick), listed);
+		CHECK(listed == expected);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
@@ -0,0 +1,79 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Hash throughput of Sha256 on its own and of the CiaVerifier every install
+// goes through. The verifier must keep up with the AM writes or hashing
+// becomes the slowest stage of the pipeline. Encrypted contents are
+// skipped, so their bytes only count as fed, not as hashed.
+
+#include <cstdio>
+#include <3ds.h>
+#include "common.h"
+#include "sha256.h"
+#include "title.h"
+
+
+
+static double mibPerSec(u64 bytes, double ms)
+{
+	return (ms > 0 ? bytes / 1048576.0 / (ms / 1000.0) : 0);
+}
+
+
+int main()
+{
+	const u32 blockSize = 0x80000;
+	const std::vector<u8> data = testData(0x4000000); // 64 MiB
+	u8 hash[SHA256_HASH_SIZE];
+
+
+	{
+		Sha256 sha;
+		u64 startTick = svcGetSystemTick();
+
+		for(u32 pos = 0; pos < data.size(); pos += blockSize) sha.update(&data[pos], blockSize);
+		sha.finish(hash);
+		double ms = ticksToMs(svcGetSystemTick() - startTick);
+
+		printf("Sha256:       %6.1f MiB in %7.1f ms  %6.1f MiB/s\n", data.size() / 1048576.0, ms, mibPerSec(data.size(), ms));
+	}
+
+	// Content 1 is marked encrypted
+	const std::vector<u8> cia = makeCia(0x0004013000001502LL, 0x2C10, {0x2000000, 0x1000000, 0x800000}, 1, 1<<1);
+
+	{
+		CiaVerifier verifier;
+		u64 startTick = svcGetSystemTick();
+
+		for(u32 pos = 0; pos < cia.size(); pos += blockSize)
+			verifier.feed(&cia[pos], (cia.size() - pos < blockSize ? cia.size() - pos : blockSize));
+		double ms = ticksToMs(svcGetSystemTick() - startTick);
+
+		printf("CiaVerifier:  %6.1f MiB in %7.1f ms  %6.1f MiB/s  hashed %.1f MiB in %.1f ms\n", cia.size() / 1048576.0, ms,
+		       mibPerSec(cia.size(), ms), verifier.hashedBytes() / 1048576.0, ticksToMs(verifier.hashTicks()));
+		printf("Verified %u contents, %u encrypted ones skipped\n", verifier.verifiedContents(), verifier.skippedContents());
+		CHECK(!verifier.failed());
+		CHECK(verifier.tmdParsed());
+		CHECK(verifier.verifiedContents() == 2);
+		CHECK(verifier.skippedContents() == 1);
+		CHECK(verifier.hashedBytes() == 0x2800000);
+	}
+
+	return testsDone();
+}
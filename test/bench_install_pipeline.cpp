@@ -0,0 +1,87 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Installs a CIA with SD reads and AM writes slowed down to card speeds.
+// The serial loop reads a block and then writes it like installCia() did
+// before the ReadPipe. installCia() reads the next blocks meanwhile so it
+// should take about as long as the slower of both sides.
+
+#include <cstdio>
+#include <3ds.h>
+#include "common.h"
+#include "misc.h"
+#include "title.h"
+
+
+
+static double installSerial(const std::u16string& path)
+{
+	u64 startTick = svcGetSystemTick();
+	fs::File file(path, FS_OPEN_READ);
+	CiaInstaller installer(MEDIATYPE_NAND);
+	Buffer<u8> buffer(MAX_BUF_SIZE, false);
+	u32 bytesRead;
+
+
+	while((bytesRead = file.read(&buffer, buffer.size()))) installer.write(&buffer, bytesRead);
+	installer.finish();
+
+	return ticksToMs(svcGetSystemTick() - startTick);
+}
+
+
+int main()
+{
+	TestSd sd;
+	ctrHost::Config& config = ctrHost::config();
+	const std::vector<u8> cia = makeCia(0x0004013000001502LL, 0x2C10, {0x1000000, 0x600000, 0x8000});
+
+
+	sd.makeDir("/updates");
+	sd.writeFile("/updates/title.cia", cia);
+	config.read    = {500, 40000}; // About 25 MiB/s
+	config.amWrite = {500, 50000}; // About 20 MiB/s
+	config.finishUs = 20000;
+
+	printf("CIA: %.1f MiB, read 40 ms/MiB, AM write 50 ms/MiB\n", cia.size() / 1048576.0);
+
+	double serialMs = installSerial(u"/updates/title.cia");
+	printf("serial read + write:      %7.1f ms\n", serialMs);
+
+	// The first run probes block sizes, the second one uses the winner
+	for(int run = 0; run < 2; run++)
+	{
+		u64 startTick = svcGetSystemTick();
+		InstallStats stats = installCia(u"/updates/title.cia", MEDIATYPE_NAND);
+		double ms = ticksToMs(svcGetSystemTick() - startTick);
+
+		printf("installCia (%s):  %7.1f ms  read %.1f ms  write %.1f ms  overlapped %.1f ms  speedup %.2fx\n",
+		       (run ? "tuned  " : "probing"), ms, ticksToMs(stats.readTicks), ticksToMs(stats.writeTicks),
+		       ticksToMs(stats.readTicks + stats.writeTicks + stats.finishTicks) - ms, serialMs / ms);
+		CHECK(stats.bytes == cia.size());
+		CHECK(ms < serialMs);
+	}
+
+	std::vector<ctrHost::AmInstall> installs = ctrHost::amInstalls();
+	CHECK(installs.size() == 3);
+	for(auto& it : installs) CHECK(it.titleID == 0x0004013000001502LL && it.bytes == cia.size());
+
+	return testsDone();
+}
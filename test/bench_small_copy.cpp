@@ -0,0 +1,108 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Copies many small files with FS latencies close to the SD card. One
+// after another on this thread against SmallFileCopier with the workers
+// of the Old 3DS (2) and the New 3DS (4). The workers only wait for IPC
+// side by side so the time should drop about with the number of workers.
+
+#include <cstdio>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+#define FILE_COUNT  (300)
+#define FILE_SIZE   (0x4000)
+
+
+
+static std::u16string fileName(const char *dir, u32 i)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "%s/%04u.bin", dir, (unsigned int)i);
+	return toUtf16(name);
+}
+
+
+static bool copiesMatch(TestSd& sd, const char *dir)
+{
+	for(u32 i = 0; i < FILE_COUNT; i++)
+	{
+		if(sd.readFile(toUtf8(fileName(dir, i))) != testData(FILE_SIZE, i)) return false;
+	}
+
+	return true;
+}
+
+
+int main()
+{
+	TestSd sd;
+	ctrHost::Config& config = ctrHost::config();
+	double serialMs = 0;
+
+
+	sd.makeDir("/src");
+	for(u32 i = 0; i < FILE_COUNT; i++) sd.writeFile(toUtf8(fileName("/src", i)), testData(FILE_SIZE, i));
+
+	config.openUs    = 1500;
+	config.metaUs    = 1000;
+	config.read      = {300, 20000};
+	config.write     = {300, 40000};
+	printf("%u files of %u KB, open 1.5 ms, create 1 ms\n", FILE_COUNT, FILE_SIZE / 1024);
+
+	try
+	{
+		sd.makeDir("/serial");
+		u64 startTick = svcGetSystemTick();
+		for(u32 i = 0; i < FILE_COUNT; i++) fs::copyFile(fileName("/src", i), fileName("/serial", i));
+		serialMs = ticksToMs(svcGetSystemTick() - startTick);
+
+		printf("copyFile one by one:  %7.1f ms  %6.1f files/s\n", serialMs, FILE_COUNT * 1000.0 / serialMs);
+		CHECK(copiesMatch(sd, "/serial"));
+
+		double lastMs = serialMs;
+		for(int new3ds = 0; new3ds < 2; new3ds++)
+		{
+			const char *dir = (new3ds ? "/new3ds" : "/old3ds");
+
+			config.new3ds = new3ds;
+			sd.makeDir(dir);
+			startTick = svcGetSystemTick();
+			{
+				fs::SmallFileCopier copier;
+				for(u32 i = 0; i < FILE_COUNT; i++) copier.add(fileName("/src", i), fileName(dir, i));
+				CHECK(copier.wait() == FILE_COUNT);
+			}
+			double ms = ticksToMs(svcGetSystemTick() - startTick);
+
+			printf("SmallFileCopier (%u):  %7.1f ms  %6.1f files/s  speedup %.2fx\n", (new3ds ? COPY_WORKERS_NEW3DS : COPY_WORKERS_OLD3DS),
+			       ms, FILE_COUNT * 1000.0 / ms, serialMs / ms);
+			CHECK(copiesMatch(sd, dir));
+			CHECK(ms < lastMs * 0.8);
+			lastMs = ms;
+		}
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
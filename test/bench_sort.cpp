@@ -0,0 +1,97 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Sorting dir listings of 1k to 100k entries. std::sort with fileNameCmp
+// like listDirContents() did before against sortDirEntries() with its
+// precomputed keys, for the whole listing and for the first page only.
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+#include "misc.h"
+
+
+
+#define PAGE_SIZE  (50) // Entries a UI shows at once
+
+
+
+static std::vector<fs::DirEntry> makeEntries(u32 count)
+{
+	static const char *words[] = {"Update", "system", "NATIVE_FIRM", "title", "Backup", "cia", "Data", "save", "Home Menu", "dlc"};
+	std::vector<fs::DirEntry> entries;
+	u32 x = count * 2654435761u + 1;
+	char name[64];
+
+
+	for(u32 i = 0; i < count; i++)
+	{
+		x ^= x<<13; x ^= x>>17; x ^= x<<5; // xorshift32
+		snprintf(name, sizeof(name), "%s %s_%u%s", words[x % 10], words[(x>>4) % 10], (x>>8) % 100000, ((x>>28) & 1 ? ".cia" : ".CIA"));
+		entries.emplace_back(toUtf16(name), !(x>>29), x & 0xFFFFF);
+	}
+
+	return entries;
+}
+
+
+static double timeSort(std::vector<fs::DirEntry> entries, std::function<void (std::vector<fs::DirEntry>& entries)> sort, std::vector<fs::DirEntry>& sorted)
+{
+	u64 startTick = svcGetSystemTick();
+
+	sort(entries);
+	double ms = ticksToMs(svcGetSystemTick() - startTick);
+	sorted.swap(entries);
+	return ms;
+}
+
+
+int main()
+{
+	printf("entries   fileNameCmp  sortDirEntries  first %u\n", PAGE_SIZE);
+
+	for(u32 count = 1000; count <= 100000; count *= 10)
+	{
+		const std::vector<fs::DirEntry> entries = makeEntries(count);
+		std::vector<fs::DirEntry> old, full, page;
+
+		double oldMs = timeSort(entries, [](std::vector<fs::DirEntry>& e) {std::sort(e.begin(), e.end(), fileNameCmp);}, old);
+		double fullMs = timeSort(entries, [](std::vector<fs::DirEntry>& e) {fs::sortDirEntries(e);}, full);
+		double pageMs = timeSort(entries, [](std::vector<fs::DirEntry>& e) {fs::sortDirEntries(e, PAGE_SIZE);}, page);
+
+		printf("%7u   %8.2f ms   %8.2f ms    %8.2f ms   (%.1fx, %.1fx)\n", count, oldMs, fullMs, pageMs, oldMs / fullMs, oldMs / pageMs);
+
+		// Dirs first, then files. The page is the start of the full sort.
+		bool dirsFirst = true, samePage = true;
+		for(u32 i = 1; i < full.size(); i++) dirsFirst &= full[i - 1].isDir || !full[i].isDir;
+		for(u32 i = 0; i < PAGE_SIZE; i++) samePage &= page[i].name == full[i].name;
+		CHECK(full.size() == count && dirsFirst && samePage);
+		if(count == 100000) CHECK(pageMs < fullMs);
+	}
+
+	// Natural order ignoring case
+	std::vector<fs::DirEntry> entries = {{u"b10", false, 0}, {u"B2", false, 0}, {u"a", false, 0}, {u"z", true, 0}, {u"b1", false, 0}};
+	fs::sortDirEntries(entries);
+	CHECK(entries[0].name == u"z" && entries[1].name == u"a" && entries[2].name == u"b1" && entries[3].name == u"B2" && entries[4].name == u"b10");
+
+	return testsDone();
+}
@@ -0,0 +1,166 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// IPC an extraction like unzipToDir() costs: 40 dirs three levels deep with
+// 10 files each. Every file gets makePath(), an existence check, a write and
+// a verify pass that asks for its size twice. Once with the dir cache and
+// once with it cleared before every step, which is what it was like
+// without one. Then the cache has to agree with the FS after rewrites,
+// deletes, moves and deleted trees.
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+#define DIR_COUNT   (40)
+#define FILE_COUNT  (10) // Per dir
+
+
+
+struct IpcCounts
+{
+	u64 makePath, exist, write, verify;
+
+	u64 total() const {return makePath + exist + write + verify;}
+};
+
+
+static std::u16string dirName(const std::string& root, u32 dir)
+{
+	return toUtf16(root + "/pkg" + std::to_string(dir / 10) + "/sub" + std::to_string(dir % 10) + "/data");
+}
+
+
+static std::u16string fileName(const std::string& root, u32 dir, u32 file)
+{
+	return dirName(root, dir) + toUtf16("/f" + std::to_string(file) + ".bin");
+}
+
+
+// Counts the IPC of func into counter
+static void count(u64& counter, bool cached, std::function<void ()> func)
+{
+	if(!cached) fs::clearDirCache();
+
+	const u64 before = ctrHost::ipcCount();
+	func();
+	counter += ctrHost::ipcCount() - before;
+}
+
+
+static IpcCounts extract(const std::string& root, bool cached)
+{
+	IpcCounts counts = {0, 0, 0, 0};
+	bool sizesOk = true;
+
+
+	fs::makeDir(toUtf16(root));
+	fs::clearDirCache();
+	for(u32 dir = 0; dir < DIR_COUNT; dir++)
+	{
+		for(u32 file = 0; file < FILE_COUNT; file++)
+		{
+			const std::u16string path = fileName(root, dir, file);
+
+			count(counts.makePath, cached, [&]() {fs::makePath(dirName(root, dir));});
+			count(counts.exist, cached, [&]() {if(fs::fileExist(path)) fs::deleteFile(path);});
+			count(counts.write, cached, [&]()
+			{
+				fs::File out(path, FS_OPEN_WRITE|FS_OPEN_CREATE);
+				out.write("0123456789", file + 1);
+			});
+		}
+	}
+
+	for(u32 dir = 0; dir < DIR_COUNT; dir++)
+	{
+		for(u32 file = 0; file < FILE_COUNT; file++)
+		{
+			count(counts.verify, cached, [&]()
+			{
+				fs::File in(fileName(root, dir, file), FS_OPEN_READ);
+
+				in.seek(0, FS_SEEK_END);
+				sizesOk &= (fs::fileExist(fileName(root, dir, file)) && in.tell() == file + 1 && in.size() == file + 1);
+			});
+		}
+	}
+	CHECK(sizesOk);
+
+	return counts;
+}
+
+
+static void printCounts(const char *name, const IpcCounts& counts)
+{
+	printf("%-9s makePath %5llu  exist %5llu  write %5llu  verify %5llu  total %5llu\n", name,
+	       (unsigned long long)counts.makePath, (unsigned long long)counts.exist, (unsigned long long)counts.write,
+	       (unsigned long long)counts.verify, (unsigned long long)counts.total());
+}
+
+
+int main()
+{
+	TestSd sd;
+
+
+	try
+	{
+		const IpcCounts uncached = extract("/plain", false);
+		const IpcCounts cached = extract("/ex", true);
+
+		printCounts("no cache", uncached);
+		printCounts("cache", cached);
+		printf("saved %.1f%% of the IPC\n", 100.0 - cached.total() * 100.0 / uncached.total());
+		CHECK(cached.makePath < uncached.makePath && cached.exist < uncached.exist);
+		CHECK(cached.total() < uncached.total());
+
+		// A rewrite with a new size
+		{
+			fs::File out(u"/ex/pkg0/sub0/data/f0.bin", FS_OPEN_WRITE);
+			out.setSize(100);
+		}
+		CHECK(fs::File(u"/ex/pkg0/sub0/data/f0.bin", FS_OPEN_READ).size() == 100);
+
+		fs::deleteFile(u"/ex/pkg0/sub0/data/f1.bin");
+		CHECK(!fs::fileExist(u"/ex/pkg0/sub0/data/f1.bin"));
+
+		fs::moveFile(u"/ex/pkg0/sub0/data/f2.bin", u"/ex/pkg0/sub0/data/F9X.bin");
+		CHECK(!fs::fileExist(u"/ex/pkg0/sub0/data/f2.bin") && fs::fileExist(u"/ex/pkg0/sub0/data/F9X.bin"));
+		CHECK(sd.exists("/ex/pkg0/sub0/data/F9X.bin"));
+
+		// Files aren't dirs and the other way around
+		CHECK(!fs::dirExist(u"/ex/pkg0/sub0/data/f3.bin") && fs::fileExist(u"/ex/pkg0/sub0/data/f3.bin"));
+		CHECK(!fs::fileExist(u"/ex/pkg0/sub0") && fs::dirExist(u"/ex/pkg0/sub0"));
+
+		fs::deleteDir(u"/ex/pkg1");
+		CHECK(!fs::dirExist(u"/ex/pkg1/sub1/data") && !fs::fileExist(u"/ex/pkg1/sub1/data/f0.bin"));
+		fs::makePath(u"/ex/pkg1/sub1/data");
+		CHECK(fs::dirExist(u"/ex/pkg1/sub1/data") && !fs::fileExist(u"/ex/pkg1/sub1/data/f0.bin"));
+		CHECK(sd.exists("/ex/pkg1/sub1/data") && !sd.exists("/ex/pkg1/sub1/data/f0.bin"));
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
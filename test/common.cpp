@@ -0,0 +1,358 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+#include "sha256.h"
+
+// Defined by main.cpp in the app
+u8 sysLang = 0;
+
+static u32 checks = 0, failures = 0;
+
+
+
+bool checkResult(bool ok, const char *expr, const char *file, int line)
+{
+	checks++;
+	if(!ok)
+	{
+		failures++;
+		printf("FAIL %s:%d: %s\n", file, line, expr);
+	}
+
+	return ok;
+}
+
+
+int testsDone()
+{
+	printf("%u checks, %u failed\n", checks, failures);
+	return (failures ? 1 : 0);
+}
+
+
+//===============================================
+// class TestSd                                ||
+//===============================================
+
+static int removeEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+
+TestSd::TestSd()
+{
+	char tmpl[] = "/tmp/sysUpdater-sd-XXXXXX";
+
+
+	if(!mkdtemp(tmpl)) {perror("mkdtemp"); exit(2);}
+	_dir_ = tmpl;
+	ctrHost::setRoot(_dir_);
+	fs::clearDirCache();
+	sdmcArchiveInit();
+}
+
+
+TestSd::~TestSd()
+{
+	sdmcArchiveExit();
+	fs::clearDirCache();
+	if(!getenv("KEEP_TEST_SD")) nftw(_dir_.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+
+void TestSd::writeFile(const std::string& sdPath, const std::vector<u8>& data)
+{
+	FILE *f = fopen(hostPath(sdPath).c_str(), "wb");
+
+
+	if(!f) {perror(sdPath.c_str()); exit(2);}
+	if(data.size()) fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+}
+
+
+std::vector<u8> TestSd::readFile(const std::string& sdPath)
+{
+	std::vector<u8> data;
+	FILE *f = fopen(hostPath(sdPath).c_str(), "rb");
+
+
+	if(!f) return data;
+	fseek(f, 0, SEEK_END);
+	data.resize(ftell(f));
+	fseek(f, 0, SEEK_SET);
+	if(data.size() && fread(data.data(), 1, data.size(), f) != data.size()) data.clear();
+	fclose(f);
+
+	return data;
+}
+
+
+void TestSd::makeDir(const std::string& sdPath)
+{
+	for(size_t pos = 1; pos <= sdPath.length(); pos++)
+	{
+		if(pos == sdPath.length() || sdPath[pos] == '/') mkdir(hostPath(sdPath.substr(0, pos)).c_str(), 0755);
+	}
+}
+
+
+bool TestSd::exists(const std::string& sdPath)
+{
+	struct stat st;
+	return !stat(hostPath(sdPath).c_str(), &st);
+}
+
+
+//===============================================
+// Helpers                                     ||
+//===============================================
+
+std::u16string toUtf16(const std::string& str)
+{
+	return std::u16string(str.begin(), str.end());
+}
+
+
+std::string toUtf8(const std::u16string& str)
+{
+	return std::string(str.begin(), str.end());
+}
+
+
+std::vector<u8> testData(u32 size, u32 seed)
+{
+	std::vector<u8> block(0x1000), data(size);
+	u32 x = seed * 2654435761u + 1;
+
+
+	for(auto& it : block)
+	{
+		x ^= x<<13; x ^= x>>17; x ^= x<<5; // xorshift32
+		it = x;
+	}
+	for(u32 i = 0; i < size; i++) data[i] = block[i & 0xFFF];
+
+	return data;
+}
+
+
+static void putBe16(u8 *p, u16 v) {p[0] = v>>8; p[1] = v;}
+static void putBe32(u8 *p, u32 v) {p[0] = v>>24; p[1] = v>>16; p[2] = v>>8; p[3] = v;}
+static void putBe64(u8 *p, u64 v) {putBe32(p, v>>32); putBe32(p + 4, v);}
+static void putLe32(u8 *p, u32 v) {p[0] = v; p[1] = v>>8; p[2] = v>>16; p[3] = v>>24;}
+static void putLe64(u8 *p, u64 v) {putLe32(p, v); putLe32(p + 4, v>>32);}
+static void align64(std::vector<u8>& data) {data.resize((data.size() + 63) & ~63);}
+
+
+std::vector<u8> makeCia(u64 titleID, u16 version, const std::vector<u32>& contentSizes, u32 seed, u32 encryptedMask)
+{
+	const u32 certSize = 0xA00, ticketSize = 0x350;
+	const u32 sigSize = 4 + 0x100 + 0x3C; // RSA 2048
+	const u32 tmdSize = sigSize + 0xC4 + 0x900 + contentSizes.size() * 0x30;
+	std::vector<std::vector<u8>> contents;
+	std::vector<u8> cia(0x2020), tmd(tmdSize);
+	u64 contentSize = 0;
+
+
+	for(u32 i = 0; i < contentSizes.size(); i++)
+	{
+		contents.push_back(testData(contentSizes[i], seed + i));
+		contentSize += contentSizes[i];
+	}
+
+	// CIA header
+	putLe32(&cia[0x00], 0x2020);
+	putLe32(&cia[0x08], certSize);
+	putLe32(&cia[0x0C], ticketSize);
+	putLe32(&cia[0x10], tmdSize);
+	putLe64(&cia[0x18], contentSize);
+	for(u32 i = 0; i < contentSizes.size(); i++) cia[0x20 + i / 8] |= 0x80>>(i % 8);
+
+	// TMD with one chunk record per content
+	putBe32(&tmd[0], 0x10001);
+	putBe64(&tmd[sigSize + 0x4C], titleID);
+	putBe16(&tmd[sigSize + 0x9C], version);
+	putBe16(&tmd[sigSize + 0x9E], contentSizes.size());
+	for(u32 i = 0; i < contentSizes.size(); i++)
+	{
+		u8 *chunk = &tmd[sigSize + 0xC4 + 0x900 + i * 0x30];
+		Sha256 sha;
+
+		putBe32(&chunk[0], i);
+		putBe16(&chunk[4], i);
+		putBe16(&chunk[6], (encryptedMask>>i & 1));
+		putBe64(&chunk[8], contentSizes[i]);
+		sha.update(contents[i].data(), contents[i].size());
+		sha.finish(&chunk[0x10]);
+	}
+
+	align64(cia);
+	cia.resize(cia.size() + certSize, 'C');
+	align64(cia);
+	cia.resize(cia.size() + ticketSize, 'T');
+	align64(cia);
+	cia.insert(cia.end(), tmd.begin(), tmd.end());
+	align64(cia);
+	for(auto& it : contents) cia.insert(cia.end(), it.begin(), it.end());
+
+	return cia;
+}
+
+
+static void putLz4Length(std::vector<u8>& out, u32 len)
+{
+	for(; len>=255; len -= 255) out.push_back(255);
+	out.push_back(len);
+}
+
+
+// Greedy matcher with a small hash table. The last 5 bytes are always
+// literals and no match starts in the last 12 like the format requires.
+static void lz4Block(const u8 *src, u32 size, std::vector<u8>& out)
+{
+	std::vector<s32> table(0x1000, -1);
+	u32 anchor = 0, pos = 0, seq, lit, len;
+
+
+	while(size>=12 && pos<=size - 12)
+	{
+		memcpy(&seq, &src[pos], 4);
+		const u32 hash = (seq * 2654435761u)>>20;
+		const s32 cand = table[hash];
+
+		table[hash] = pos;
+		if(cand<0 || pos - cand>0xFFFF || memcmp(&src[cand], &src[pos], 4)) {pos++; continue;}
+
+		for(len = 4; pos + len<size - 5 && src[cand + len] == src[pos + len]; len++);
+		lit = pos - anchor;
+		out.push_back((lit<15 ? lit : 15)<<4 | (len - 4<15 ? len - 4 : 15));
+		if(lit>=15) putLz4Length(out, lit - 15);
+		out.insert(out.end(), &src[anchor], &src[pos]);
+		out.push_back(pos - cand);
+		out.push_back((pos - cand)>>8);
+		if(len - 4>=15) putLz4Length(out, len - 4 - 15);
+
+		pos += len;
+		anchor = pos;
+	}
+
+	lit = size - anchor;
+	out.push_back((lit<15 ? lit : 15)<<4);
+	if(lit>=15) putLz4Length(out, lit - 15);
+	out.insert(out.end(), &src[anchor], &src[size]);
+}
+
+
+std::vector<u8> lz4Frame(const std::vector<u8>& data)
+{
+	const u32 blockSize = 0x10000;
+	std::vector<u8> frame(7 + 4), block;
+
+
+	putLe32(&frame[0], 0x184D2204);
+	frame[4] = 0x60; // Version 1, independent blocks
+	frame[5] = 0x40; // 64 KB blocks
+	frame[6] = 0;    // Header checksum, nobody checks it
+
+	for(u32 pos = 0; pos<data.size(); pos += blockSize)
+	{
+		const u32 size = (data.size() - pos<blockSize ? data.size() - pos : blockSize);
+		const size_t sizePos = frame.size() - 4;
+
+		block.clear();
+		lz4Block(&data[pos], size, block);
+		if(block.size()<size)
+		{
+			putLe32(&frame[sizePos], block.size());
+			frame.insert(frame.end(), block.begin(), block.end());
+		}
+		else
+		{
+			putLe32(&frame[sizePos], size | 0x80000000);
+			frame.insert(frame.end(), &data[pos], &data[pos] + size);
+		}
+		frame.resize(frame.size() + 4);
+	}
+	putLe32(&frame[frame.size() - 4], 0); // End mark
+
+	return frame;
+}
+
+
+static void appendLe16(std::vector<u8>& out, u16 v) {out.push_back(v); out.push_back(v>>8);}
+static void appendLe32(std::vector<u8>& out, u32 v) {appendLe16(out, v); appendLe16(out, v>>16);}
+
+
+std::vector<u8> makeZip(const std::vector<std::pair<std::string, std::vector<u8>>>& files)
+{
+	std::vector<u8> zip, dir;
+
+
+	for(auto& it : files)
+	{
+		const u32 crc = crc32(0, it.second.data(), it.second.size());
+		const u32 offset = zip.size();
+
+		appendLe32(zip, 0x04034B50);
+		appendLe16(zip, 20); appendLe16(zip, 0); appendLe16(zip, 0); // Version, flags, stored
+		appendLe16(zip, 0); appendLe16(zip, 0x21);                    // 1980-01-01
+		appendLe32(zip, crc); appendLe32(zip, it.second.size()); appendLe32(zip, it.second.size());
+		appendLe16(zip, it.first.length()); appendLe16(zip, 0);
+		zip.insert(zip.end(), it.first.begin(), it.first.end());
+		zip.insert(zip.end(), it.second.begin(), it.second.end());
+
+		appendLe32(dir, 0x02014B50);
+		appendLe16(dir, 20); appendLe16(dir, 20); appendLe16(dir, 0); appendLe16(dir, 0);
+		appendLe16(dir, 0); appendLe16(dir, 0x21);
+		appendLe32(dir, crc); appendLe32(dir, it.second.size()); appendLe32(dir, it.second.size());
+		appendLe16(dir, it.first.length()); appendLe16(dir, 0); appendLe16(dir, 0); // Name, extra, comment
+		appendLe16(dir, 0); appendLe16(dir, 0); appendLe32(dir, 0);                   // Disk, attributes
+		appendLe32(dir, offset);
+		dir.insert(dir.end(), it.first.begin(), it.first.end());
+	}
+
+	const u32 dirOffset = zip.size();
+	zip.insert(zip.end(), dir.begin(), dir.end());
+	appendLe32(zip, 0x06054B50);
+	appendLe16(zip, 0); appendLe16(zip, 0);
+	appendLe16(zip, files.size()); appendLe16(zip, files.size());
+	appendLe32(zip, dir.size()); appendLe32(zip, dirOffset);
+	appendLe16(zip, 0);
+
+	return zip;
+}
+
+
+double ticksToMs(u64 ticks)
+{
+	return ticks * 1000.0 / SYSCLOCK_ARM11;
+}
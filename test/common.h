@@ -0,0 +1,81 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _TEST_COMMON_H_
+#define _TEST_COMMON_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <3ds.h>
+#include "ctr_host.h"
+
+// Counts a failed check and prints where it was. Tests keep going after a failure.
+#define CHECK(cond) checkResult((cond), #cond, __FILE__, __LINE__)
+
+
+
+bool checkResult(bool ok, const char *expr, const char *file, int line);
+int  testsDone(); // Prints the summary and returns the exit code for main()
+
+
+// A fresh host dir as SD card for as long as the object lives. The SD
+// archive is opened and the dir cache is cleared. Everything gets deleted
+// at the end unless KEEP_TEST_SD is set in the environment.
+class TestSd
+{
+	std::string _dir_;
+
+
+public:
+	TestSd();
+	~TestSd();
+
+
+	std::string hostPath(const std::string& sdPath) {return _dir_ + sdPath;}
+
+	// Straight on the host FS. These don't count as IPC and don't touch the dir cache.
+	void writeFile(const std::string& sdPath, const std::vector<u8>& data);
+	std::vector<u8> readFile(const std::string& sdPath);
+	void makeDir(const std::string& sdPath); // Including parents
+	bool exists(const std::string& sdPath);
+};
+
+
+std::u16string toUtf16(const std::string& str); // ASCII only
+std::string toUtf8(const std::u16string& str);  // ASCII only
+
+// Data that compresses a bit like real contents: a random 4 KB block repeated
+std::vector<u8> testData(u32 size, u32 seed=1);
+
+// A CIA AM and the app accept. Contents set in encryptedMask (bit n for
+// content n) are marked encrypted so the app can't check their hashes.
+std::vector<u8> makeCia(u64 titleID, u16 version, const std::vector<u32>& contentSizes, u32 seed=1, u32 encryptedMask=0);
+
+// A LZ4 frame with independent 64 KB blocks and no checksums. Blocks which
+// don't shrink are stored uncompressed.
+std::vector<u8> lz4Frame(const std::vector<u8>& data);
+
+// A ZIP with all files stored
+std::vector<u8> makeZip(const std::vector<std::pair<std::string, std::vector<u8>>>& files);
+
+double ticksToMs(u64 ticks);
+
+#endif // _TEST_COMMON_H_
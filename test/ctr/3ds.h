@@ -0,0 +1,191 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Host stand-in for the parts of libctru the app sources use. Only the
+// declarations the sources need are here. They are implemented on top of
+// a host dir by ctr_host.cpp. Knobs for tests are in ctr_host.h.
+
+#ifndef _3DS_H_
+#define _3DS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef s32 Result;
+typedef u32 Handle;
+typedef u64 FS_Archive;
+typedef s32 LightLock;
+typedef void (*ThreadFunc)(void *arg);
+typedef struct Thread_tag* Thread;
+
+#define U64_MAX          UINT64_MAX
+#define SYSCLOCK_ARM11   (268111856)
+#define CUR_THREAD_HANDLE (0xFFFF8000)
+#define R_SUCCEEDED(res) ((res)>=0)
+#define R_FAILED(res)    ((res)<0)
+
+
+typedef enum
+{
+	MEDIATYPE_NAND = 0,
+	MEDIATYPE_SD = 1,
+	MEDIATYPE_GAME_CARD = 2
+} FS_MediaType;
+
+typedef enum
+{
+	ARCHIVE_SDMC = 0x00000009,
+	ARCHIVE_SAVEDATA_AND_CONTENT = 0x2345678A
+} FS_ArchiveID;
+
+typedef enum
+{
+	PATH_INVALID = 0,
+	PATH_EMPTY = 1,
+	PATH_BINARY = 2,
+	PATH_ASCII = 3,
+	PATH_UTF16 = 4
+} FS_PathType;
+
+typedef struct
+{
+	FS_PathType type;
+	u32 size;
+	const void *data;
+} FS_Path;
+
+enum
+{
+	FS_OPEN_READ = 1,
+	FS_OPEN_WRITE = 2,
+	FS_OPEN_CREATE = 4
+};
+
+enum
+{
+	FS_WRITE_FLUSH = 1,
+	FS_WRITE_UPDATE_TIME = 0x100
+};
+
+enum
+{
+	FS_ATTRIBUTE_DIRECTORY = 1,
+	FS_ATTRIBUTE_HIDDEN = 0x100,
+	FS_ATTRIBUTE_ARCHIVE = 0x10000,
+	FS_ATTRIBUTE_READ_ONLY = 0x1000000
+};
+
+typedef struct
+{
+	u16 name[0x106];
+	char shortName[0x0A];
+	char shortExt[0x04];
+	u8 valid;
+	u8 reserved;
+	u32 attributes;
+	u64 fileSize;
+} FS_DirectoryEntry;
+
+typedef struct
+{
+	u64 titleID;
+	u64 size;
+	u16 version;
+	u8 unk[6];
+} AM_TitleEntry;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// FS
+FS_Path fsMakePath(FS_PathType type, const void *path);
+Result FSUSER_OpenArchive(FS_Archive *archive, FS_ArchiveID id, FS_Path path);
+Result FSUSER_CloseArchive(FS_Archive archive);
+Result FSUSER_OpenFile(Handle *out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes);
+Result FSUSER_OpenFileDirectly(Handle *out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes);
+Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path);
+Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+Result FSUSER_DeleteDirectory(FS_Archive archive, FS_Path path);
+Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path);
+Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes);
+Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path);
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size);
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags);
+Result FSFILE_GetSize(Handle handle, u64 *size);
+Result FSFILE_SetSize(Handle handle, u64 size);
+Result FSFILE_Flush(Handle handle);
+Result FSFILE_Close(Handle handle);
+Result FSDIR_Read(Handle handle, u32 *entriesRead, u32 entryCount, FS_DirectoryEntry *entries);
+Result FSDIR_Close(Handle handle);
+
+// AM
+Result AM_GetTitleCount(FS_MediaType mediatype, u32 *count);
+Result AM_GetTitleList(u32 *titlesRead, FS_MediaType mediatype, u32 titleCount, u64 *titleIds);
+Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64 *titleIds, AM_TitleEntry *titleInfo);
+Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char *productCode);
+Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry *titleEntry, Handle fileHandle);
+Result AM_StartCiaInstall(FS_MediaType mediatype, Handle *ciaHandle);
+Result AM_FinishCiaInstall(Handle ciaHandle);
+Result AM_CancelCIAInstall(Handle ciaHandle);
+Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID);
+Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID);
+Result AM_InstallFirm(u64 titleID);
+
+// APT
+Result APT_CheckNew3DS(bool *out);
+
+// Threads and synchronization. Only used by the _3DS backend of thread.h.
+Thread threadCreate(ThreadFunc entrypoint, void *arg, size_t stackSize, int prio, int affinity, bool detached);
+Result threadJoin(Thread thread, u64 timeoutNs);
+void   threadFree(Thread thread);
+void   LightLock_Init(LightLock *lock);
+void   LightLock_Lock(LightLock *lock);
+void   LightLock_Unlock(LightLock *lock);
+Result svcCreateSemaphore(Handle *semaphore, s32 initialCount, s32 maxCount);
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 releaseCount);
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds);
+Result svcCloseHandle(Handle handle);
+Result svcGetThreadPriority(s32 *priority, Handle handle);
+void   svcSleepThread(s64 ns);
+u64    svcGetSystemTick(void);
+
+// Unicode
+ssize_t utf16_to_utf8(u8 *out, const u16 *in, size_t len);
+ssize_t utf8_to_utf16(u16 *out, const u8 *in, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _3DS_H_
@@ -0,0 +1,934 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <3ds.h>
+#include "ctr_host.h"
+
+#define ERR_NOT_FOUND      ((Result)0xC8804478)
+#define ERR_ALREADY_EXISTS ((Result)0xC82044BE)
+#define ERR_FS_FAILED      ((Result)0xC8804464)
+#define ERR_NOT_EMPTY      ((Result)0xC82044F0)
+#define ERR_INVALID_HANDLE ((Result)0xD8E007F7)
+#define ERR_OUT_OF_RANGE   ((Result)0xD8E007FD)
+#define ERR_TIMEOUT        ((Result)0x09401BFE)
+#define ERR_AM_BAD_CIA     ((Result)0xD8A083FA)
+#define ERR_AM_BAD_ORDER   ((Result)0xD8A083F9)
+#define AM_HEAD_SIZE       (0x100000) // Bytes of each CIA kept to parse the TMD
+
+
+
+namespace
+{
+	enum ObjectKind
+	{
+		OBJ_FILE = 0,
+		OBJ_DIR,
+		OBJ_AM,
+		OBJ_SEMAPHORE
+	};
+
+	struct Object
+	{
+		ObjectKind kind;
+		int fd = -1;
+		DIR *dir = nullptr;
+		std::string path; // Host path of dirs
+
+		// AM install handles
+		std::vector<u8> head;
+		u64 bytes = 0;
+		u64 startTick = 0;
+		bool finished = false;
+
+		// Semaphores
+		std::mutex lock;
+		std::condition_variable cond;
+		s32 count = 0, maxCount = 0;
+
+		Object(ObjectKind kind) : kind(kind) {}
+		~Object() {if(fd >= 0) close(fd); if(dir) closedir(dir);}
+	};
+
+	typedef std::shared_ptr<Object> ObjectPtr;
+
+	struct State
+	{
+		std::mutex lock;
+		std::map<Handle, ObjectPtr> objects;
+		Handle nextHandle = 0x100;
+		std::string root = "/tmp/sysUpdater-sd";
+		ctrHost::Config config;
+		std::atomic<u64> ipc;
+		std::atomic<u32> sleeping, maxSleeping; // Calls in their latency
+		std::map<u64, u16> titles; // NAND titles
+		std::vector<ctrHost::AmInstall> installs;
+		u32 cancelled = 0;
+		u32 threads = 0;
+
+		State() : config(), ipc(0), sleeping(0), maxSleeping(0) {}
+	};
+
+	// Never destroyed. Static objects of the app create semaphores before
+	// and after this file is initialized.
+	State& state()
+	{
+		static State *s = new State;
+		return *s;
+	}
+
+
+	Handle addObject(ObjectPtr obj)
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		Handle handle = s.nextHandle++;
+		s.objects[handle] = obj;
+		return handle;
+	}
+
+	ObjectPtr getObject(Handle handle, ObjectKind kind)
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		auto it = s.objects.find(handle);
+		if(it == s.objects.end() || it->second->kind != kind) return nullptr;
+		return it->second;
+	}
+
+	ObjectPtr removeObject(Handle handle)
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		auto it = s.objects.find(handle);
+		if(it == s.objects.end()) return nullptr;
+		ObjectPtr obj = it->second;
+		s.objects.erase(it);
+		return obj;
+	}
+
+
+	void ipc() {state().ipc++;}
+
+	void delay(u32 us)
+	{
+		if(!us) return;
+
+		State& s = state();
+		u32 now = ++s.sleeping, max = s.maxSleeping;
+		while(now > max && !s.maxSleeping.compare_exchange_weak(max, now));
+		std::this_thread::sleep_for(std::chrono::microseconds(us));
+		s.sleeping--;
+	}
+
+	void delay(const ctrHost::Latency& latency, u32 size)
+	{
+		delay(latency.perCall + (u32)((u64)size * latency.perMiB / 0x100000));
+	}
+
+
+	u16 getBe16(const u8 *p) {return p[0]<<8 | p[1];}
+	u32 getBe32(const u8 *p) {return (u32)p[0]<<24 | p[1]<<16 | p[2]<<8 | p[3];}
+	u64 getBe64(const u8 *p) {return (u64)getBe32(p)<<32 | getBe32(p + 4);}
+	u32 getLe32(const u8 *p) {return p[0] | p[1]<<8 | p[2]<<16 | (u32)p[3]<<24;}
+	u64 getLe64(const u8 *p) {return getLe32(p) | (u64)getLe32(p + 4)<<32;}
+	u64 align64(u64 x) {return (x + 63) & ~63ULL;}
+
+	// Reads the title ID and version from the TMD. end is the offset
+	// right after the contents. Returns false if cia is too short or broken.
+	bool parseCia(const u8 *cia, u64 size, AM_TitleEntry& entry, u64& end)
+	{
+		if(size < 0x20 || getLe32(cia) != 0x2020) return false;
+
+		const u64 tmdOffset = align64(0x2020) + align64(getLe32(cia + 8)) + align64(getLe32(cia + 0xC));
+		const u64 contentOffset = align64(tmdOffset + getLe32(cia + 0x10));
+		if(tmdOffset + 4 > size) return false;
+
+		u32 sigSize;
+		switch(getBe32(cia + tmdOffset))
+		{
+			case 0x10000:
+			case 0x10003: sigSize = 0x200 + 0x3C; break;
+			case 0x10001:
+			case 0x10004: sigSize = 0x100 + 0x3C; break;
+			case 0x10002:
+			case 0x10005: sigSize = 0x3C + 0x40; break;
+			default: return false;
+		}
+
+		const u8 *hdr = cia + tmdOffset + 4 + sigSize;
+		if(tmdOffset + 4 + sigSize + 0xC4 > size) return false;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.titleID = getBe64(hdr + 0x4C);
+		entry.version = getBe16(hdr + 0x9C);
+		entry.size = getLe64(cia + 0x18);
+		end = contentOffset + entry.size;
+		return true;
+	}
+
+
+	std::string utf16ToHost(const u16 *in)
+	{
+		std::string out;
+
+		for(; *in; in++)
+		{
+			u32 c = *in;
+			if(c < 0x80) out += (char)c;
+			else if(c < 0x800) {out += (char)(0xC0 | c>>6); out += (char)(0x80 | (c & 0x3F));}
+			else {out += (char)(0xE0 | c>>12); out += (char)(0x80 | (c>>6 & 0x3F)); out += (char)(0x80 | (c & 0x3F));}
+		}
+
+		return out;
+	}
+
+	u32 hostToUtf16(const char *in, u16 *out, u32 max)
+	{
+		const u8 *p = (const u8*)in;
+		u32 len = 0;
+
+		while(*p && len < max)
+		{
+			u32 c = *p++;
+			if(c >= 0xE0) {c = (c & 0x0F)<<12; c |= (*p++ & 0x3F)<<6; c |= *p++ & 0x3F;}
+			else if(c >= 0xC0) {c = (c & 0x1F)<<6; c |= *p++ & 0x3F;}
+			out[len++] = c;
+		}
+
+		return len;
+	}
+
+	// Finds the host path for an SD path. Existing components are matched
+	// ignoring A-Z case. The rest is taken as it is.
+	std::string resolve(const std::string& sdPath)
+	{
+		std::string path = state().root;
+		size_t pos = 0;
+		bool exists = true;
+
+
+		while(pos < sdPath.length())
+		{
+			size_t end = sdPath.find('/', pos);
+			if(end == std::string::npos) end = sdPath.length();
+			const std::string name = sdPath.substr(pos, end - pos);
+			pos = end + 1;
+			if(name.empty()) continue;
+
+			std::string next = path + "/" + name;
+			struct stat st;
+			if(exists && lstat(next.c_str(), &st))
+			{
+				exists = false;
+				if(DIR *dir = opendir(path.c_str()))
+				{
+					while(struct dirent *ent = readdir(dir))
+					{
+						if(!strcasecmp(ent->d_name, name.c_str())) {next = path + "/" + ent->d_name; exists = true; break;}
+					}
+					closedir(dir);
+				}
+			}
+			path = next;
+		}
+
+		return path;
+	}
+
+	std::string hostPath(const FS_Path& path)
+	{
+		if(path.type == PATH_UTF16) return resolve(utf16ToHost((const u16*)path.data));
+		if(path.type == PATH_ASCII) return resolve((const char*)path.data);
+		return state().root;
+	}
+
+	int statType(const std::string& path)
+	{
+		struct stat st;
+		if(stat(path.c_str(), &st)) return 0;
+		return (S_ISDIR(st.st_mode) ? 2 : 1);
+	}
+
+	Result errnoResult()
+	{
+		switch(errno)
+		{
+			case ENOENT: return ERR_NOT_FOUND;
+			case EEXIST: return ERR_ALREADY_EXISTS;
+			case ENOTEMPTY: return ERR_NOT_EMPTY;
+			default: return ERR_FS_FAILED;
+		}
+	}
+
+
+	int removeEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+	{
+		delay(state().config.metaUs);
+		return remove(path);
+	}
+} // namespace
+
+
+
+//===============================================
+// ctrHost                                     ||
+//===============================================
+
+namespace ctrHost
+{
+	void setRoot(const std::string& hostDir)
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		s.root = hostDir;
+		while(s.root.length() > 1 && s.root.back() == '/') s.root.pop_back();
+		s.config = Config();
+		s.ipc = 0;
+		s.maxSleeping = 0;
+		s.titles.clear();
+		s.installs.clear();
+		s.cancelled = 0;
+	}
+
+	const std::string& root() {return state().root;}
+	std::string hostPath(const std::string& sdPath) {return resolve(sdPath);}
+
+	Config& config() {return state().config;}
+	u64  ipcCount() {return state().ipc;}
+	void resetIpcCount() {state().ipc = 0; state().maxSleeping = 0;}
+	u32  maxConcurrentCalls() {return state().maxSleeping;}
+
+
+	void addInstalledTitle(u64 titleID, u16 version)
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		s.titles[titleID] = version;
+	}
+
+	std::vector<AM_TitleEntry> installedTitles()
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+		std::vector<AM_TitleEntry> titles;
+
+		for(auto& it : s.titles)
+		{
+			AM_TitleEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			entry.titleID = it.first;
+			entry.version = it.second;
+			titles.push_back(entry);
+		}
+
+		return titles;
+	}
+
+
+	std::vector<AmInstall> amInstalls()
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		return s.installs;
+	}
+
+	u32 cancelledInstalls() {return state().cancelled;}
+
+	void clearAmRecords()
+	{
+		State& s = state();
+		std::lock_guard<std::mutex> guard(s.lock);
+
+		s.installs.clear();
+		s.cancelled = 0;
+	}
+} // namespace ctrHost
+
+
+
+//===============================================
+// FS                                          ||
+//===============================================
+
+extern "C"
+{
+
+FS_Path fsMakePath(FS_PathType type, const void *path)
+{
+	FS_Path p = {type, 0, path};
+
+	if(type == PATH_ASCII) p.size = strlen((const char*)path) + 1;
+	else if(type == PATH_UTF16)
+	{
+		const u16 *str = (const u16*)path;
+		while(str[p.size / 2]) p.size += 2;
+		p.size += 2;
+	}
+
+	return p;
+}
+
+Result FSUSER_OpenArchive(FS_Archive *archive, FS_ArchiveID id, FS_Path path)
+{
+	ipc();
+	*archive = id;
+	return 0;
+}
+
+Result FSUSER_CloseArchive(FS_Archive archive)
+{
+	ipc();
+	return 0;
+}
+
+Result FSUSER_OpenFile(Handle *out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes)
+{
+	ipc();
+	delay(state().config.openUs);
+
+	const std::string host = hostPath(path);
+	if(statType(host) == 2) return ERR_NOT_FOUND;
+
+	int fd = open(host.c_str(), ((openFlags & FS_OPEN_WRITE) ? O_RDWR : O_RDONLY) | ((openFlags & FS_OPEN_CREATE) ? O_CREAT : 0), 0644);
+	if(fd < 0) return errnoResult();
+
+	ObjectPtr obj(new Object(OBJ_FILE));
+	obj->fd = fd;
+	*out = addObject(obj);
+	return 0;
+}
+
+Result FSUSER_OpenFileDirectly(Handle *out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes)
+{
+	ipc();
+	return ERR_NOT_FOUND; // Title contents aren't emulated
+}
+
+Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path)
+{
+	ipc();
+	delay(state().config.metaUs);
+
+	const std::string host = hostPath(path);
+	if(statType(host) != 1) return ERR_NOT_FOUND;
+	return (unlink(host.c_str()) ? errnoResult() : 0);
+}
+
+Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+{
+	ipc();
+	delay(state().config.metaUs);
+
+	const std::string src = hostPath(srcPath), dst = hostPath(dstPath);
+	if(statType(src) != 1) return ERR_NOT_FOUND;
+	if(statType(dst)) return ERR_ALREADY_EXISTS;
+	return (rename(src.c_str(), dst.c_str()) ? errnoResult() : 0);
+}
+
+Result FSUSER_DeleteDirectory(FS_Archive archive, FS_Path path)
+{
+	ipc();
+	delay(state().config.metaUs);
+
+	const std::string host = hostPath(path);
+	if(statType(host) != 2) return ERR_NOT_FOUND;
+	return (rmdir(host.c_str()) ? errnoResult() : 0);
+}
+
+Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path)
+{
+	ipc();
+
+	const std::string host = hostPath(path);
+	if(statType(host) != 2) return ERR_NOT_FOUND;
+	return (nftw(host.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS) ? ERR_FS_FAILED : 0);
+}
+
+Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes)
+{
+	ipc();
+	delay(state().config.metaUs);
+
+	return (mkdir(hostPath(path).c_str(), 0755) ? errnoResult() : 0);
+}
+
+Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+{
+	ipc();
+	delay(state().config.metaUs);
+
+	const std::string src = hostPath(srcPath), dst = hostPath(dstPath);
+	if(statType(src) != 2) return ERR_NOT_FOUND;
+	if(statType(dst)) return ERR_ALREADY_EXISTS;
+	return (rename(src.c_str(), dst.c_str()) ? errnoResult() : 0);
+}
+
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path)
+{
+	ipc();
+	delay(state().config.openUs);
+
+	const std::string host = hostPath(path);
+	DIR *dir = opendir(host.c_str());
+	if(!dir) return ERR_NOT_FOUND;
+
+	ObjectPtr obj(new Object(OBJ_DIR));
+	obj->dir = dir;
+	obj->path = host;
+	*out = addObject(obj);
+	return 0;
+}
+
+
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size)
+{
+	ipc();
+	ObjectPtr obj = getObject(handle, OBJ_FILE);
+	if(!obj) return ERR_INVALID_HANDLE;
+	delay(state().config.read, size);
+
+	ssize_t res = pread(obj->fd, buffer, size, offset);
+	if(res < 0) return errnoResult();
+	if(bytesRead) *bytesRead = res;
+	return 0;
+}
+
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags)
+{
+	ipc();
+
+	// AM takes the CIA in order only
+	if(ObjectPtr am = getObject(handle, OBJ_AM))
+	{
+		delay(state().config.amWrite, size);
+		if(am->finished || offset != am->bytes) return ERR_AM_BAD_ORDER;
+
+		if(am->head.size() < AM_HEAD_SIZE)
+		{
+			const u32 keep = std::min<u64>(size, AM_HEAD_SIZE - am->head.size());
+			am->head.insert(am->head.end(), (const u8*)buffer, (const u8*)buffer + keep);
+		}
+		am->bytes += size;
+		if(bytesWritten) *bytesWritten = size;
+		return 0;
+	}
+
+	ObjectPtr obj = getObject(handle, OBJ_FILE);
+	if(!obj) return ERR_INVALID_HANDLE;
+	delay(state().config.write, size);
+
+	ssize_t res = pwrite(obj->fd, buffer, size, offset);
+	if(res < 0) return errnoResult();
+	if(bytesWritten) *bytesWritten = res;
+	return 0;
+}
+
+Result FSFILE_GetSize(Handle handle, u64 *size)
+{
+	ipc();
+	ObjectPtr obj = getObject(handle, OBJ_FILE);
+	if(!obj) return ERR_INVALID_HANDLE;
+
+	struct stat st;
+	if(fstat(obj->fd, &st)) return errnoResult();
+	*size = st.st_size;
+	return 0;
+}
+
+Result FSFILE_SetSize(Handle handle, u64 size)
+{
+	ipc();
+	ObjectPtr obj = getObject(handle, OBJ_FILE);
+	if(!obj) return ERR_INVALID_HANDLE;
+	delay(state().config.metaUs);
+
+	return (ftruncate(obj->fd, size) ? errnoResult() : 0);
+}
+
+Result FSFILE_Flush(Handle handle)
+{
+	ipc();
+	if(!getObject(handle, OBJ_FILE) && !getObject(handle, OBJ_AM)) return ERR_INVALID_HANDLE;
+	return 0;
+}
+
+Result FSFILE_Close(Handle handle)
+{
+	ipc();
+	delay(state().config.openUs);
+
+	return (removeObject(handle) ? 0 : ERR_INVALID_HANDLE);
+}
+
+
+Result FSDIR_Read(Handle handle, u32 *entriesRead, u32 entryCount, FS_DirectoryEntry *entries)
+{
+	ipc();
+	ObjectPtr obj = getObject(handle, OBJ_DIR);
+	if(!obj) return ERR_INVALID_HANDLE;
+	delay(state().config.dirReadUs);
+
+	u32 count = 0;
+	while(count < entryCount)
+	{
+		struct dirent *ent = readdir(obj->dir);
+		if(!ent) break;
+		if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+
+		FS_DirectoryEntry& entry = entries[count++];
+		memset(&entry, 0, sizeof(entry));
+		hostToUtf16(ent->d_name, entry.name, 0x105);
+
+		struct stat st;
+		if(stat((obj->path + "/" + ent->d_name).c_str(), &st)) continue;
+		entry.attributes = (S_ISDIR(st.st_mode) ? FS_ATTRIBUTE_DIRECTORY : FS_ATTRIBUTE_ARCHIVE);
+		entry.fileSize = (S_ISDIR(st.st_mode) ? 0 : st.st_size);
+	}
+
+	*entriesRead = count;
+	return 0;
+}
+
+Result FSDIR_Close(Handle handle)
+{
+	ipc();
+	delay(state().config.openUs);
+
+	return (removeObject(handle) ? 0 : ERR_INVALID_HANDLE);
+}
+
+
+
+//===============================================
+// AM                                          ||
+//===============================================
+
+Result AM_GetTitleCount(FS_MediaType mediatype, u32 *count)
+{
+	ipc();
+	*count = (mediatype == MEDIATYPE_NAND ? ctrHost::installedTitles().size() : 0);
+	return 0;
+}
+
+Result AM_GetTitleList(u32 *titlesRead, FS_MediaType mediatype, u32 titleCount, u64 *titleIds)
+{
+	ipc();
+	std::vector<AM_TitleEntry> titles;
+	if(mediatype == MEDIATYPE_NAND) titles = ctrHost::installedTitles();
+
+	u32 count = 0;
+	for(; count < titleCount && count < titles.size(); count++) titleIds[count] = titles[count].titleID;
+	*titlesRead = count;
+	return 0;
+}
+
+Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64 *titleIds, AM_TitleEntry *titleInfo)
+{
+	ipc();
+	State& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+
+	for(u32 i = 0; i < titleCount; i++)
+	{
+		auto it = s.titles.find(titleIds[i]);
+		if(mediatype != MEDIATYPE_NAND || it == s.titles.end()) return ERR_NOT_FOUND;
+
+		memset(&titleInfo[i], 0, sizeof(AM_TitleEntry));
+		titleInfo[i].titleID = it->first;
+		titleInfo[i].version = it->second;
+	}
+
+	return 0;
+}
+
+Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char *productCode)
+{
+	ipc();
+	return ERR_NOT_FOUND;
+}
+
+Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry *titleEntry, Handle fileHandle)
+{
+	ipc();
+	ObjectPtr obj = getObject(fileHandle, OBJ_FILE);
+	if(!obj) return ERR_INVALID_HANDLE;
+
+	std::vector<u8> head(0x10000);
+	ssize_t size = pread(obj->fd, &head[0], head.size(), 0);
+	u64 end;
+	if(size < 0 || !parseCia(&head[0], size, *titleEntry, end)) return ERR_AM_BAD_CIA;
+	return 0;
+}
+
+Result AM_StartCiaInstall(FS_MediaType mediatype, Handle *ciaHandle)
+{
+	ipc();
+	ObjectPtr obj(new Object(OBJ_AM));
+	obj->startTick = svcGetSystemTick();
+	*ciaHandle = addObject(obj);
+	return 0;
+}
+
+Result AM_FinishCiaInstall(Handle ciaHandle)
+{
+	ipc();
+	ObjectPtr am = getObject(ciaHandle, OBJ_AM);
+	if(!am) return ERR_INVALID_HANDLE;
+	if(am->finished) return ERR_AM_BAD_ORDER;
+	delay(state().config.finishUs);
+
+	AM_TitleEntry entry;
+	u64 end;
+	am->finished = true;
+	if(!parseCia(am->head.data(), am->head.size(), entry, end) || am->bytes < end) return ERR_AM_BAD_CIA;
+
+	ctrHost::AmInstall install = {entry.titleID, entry.version, am->bytes, am->startTick, svcGetSystemTick(), false};
+	State& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.titles[entry.titleID] = entry.version;
+	s.installs.push_back(install);
+	return 0;
+}
+
+Result AM_CancelCIAInstall(Handle ciaHandle)
+{
+	ipc();
+	if(!removeObject(ciaHandle)) return ERR_INVALID_HANDLE;
+	state().cancelled++;
+	return 0;
+}
+
+Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID)
+{
+	ipc();
+	State& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+
+	s.titles.erase(titleID);
+	return 0;
+}
+
+Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID)
+{
+	return AM_DeleteTitle(mediatype, titleID);
+}
+
+Result AM_InstallFirm(u64 titleID)
+{
+	ipc();
+	u64 startTick = svcGetSystemTick();
+	delay(state().config.finishUs);
+
+	ctrHost::AmInstall install = {titleID, 0, 0, startTick, svcGetSystemTick(), true};
+	State& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.installs.push_back(install);
+	return 0;
+}
+
+
+Result APT_CheckNew3DS(bool *out)
+{
+	*out = state().config.new3ds;
+	return 0;
+}
+
+
+
+//===============================================
+// Threads and synchronization                 ||
+//===============================================
+
+struct Thread_tag
+{
+	std::thread thread;
+};
+
+Thread threadCreate(ThreadFunc entrypoint, void *arg, size_t stackSize, int prio, int affinity, bool detached)
+{
+	State& s = state();
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		if(s.config.threadLimit && s.threads >= s.config.threadLimit) return nullptr;
+		s.threads++;
+	}
+
+	Thread thread = new Thread_tag;
+	thread->thread = std::thread(entrypoint, arg);
+	return thread;
+}
+
+Result threadJoin(Thread thread, u64 timeoutNs)
+{
+	if(thread->thread.joinable()) thread->thread.join();
+	return 0;
+}
+
+void threadFree(Thread thread)
+{
+	State& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+
+	delete thread;
+	s.threads--;
+}
+
+
+void LightLock_Init(LightLock *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void LightLock_Lock(LightLock *lock)
+{
+	s32 unlocked = 0;
+	while(!__atomic_compare_exchange_n(lock, &unlocked, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		unlocked = 0;
+		std::this_thread::yield();
+	}
+}
+
+void LightLock_Unlock(LightLock *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+
+Result svcCreateSemaphore(Handle *semaphore, s32 initialCount, s32 maxCount)
+{
+	ObjectPtr obj(new Object(OBJ_SEMAPHORE));
+	obj->count = initialCount;
+	obj->maxCount = maxCount;
+	*semaphore = addObject(obj);
+	return 0;
+}
+
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 releaseCount)
+{
+	ObjectPtr obj = getObject(semaphore, OBJ_SEMAPHORE);
+	if(!obj) return ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> guard(obj->lock);
+	if(obj->count + releaseCount > obj->maxCount) return ERR_OUT_OF_RANGE;
+	*count = obj->count;
+	obj->count += releaseCount;
+	obj->cond.notify_all();
+	return 0;
+}
+
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds)
+{
+	ObjectPtr obj = getObject(handle, OBJ_SEMAPHORE);
+	if(!obj) return ERR_INVALID_HANDLE;
+
+	std::unique_lock<std::mutex> lock(obj->lock);
+	if(nanoseconds < 0) obj->cond.wait(lock, [&obj]() {return obj->count > 0;});
+	else if(!obj->cond.wait_for(lock, std::chrono::nanoseconds(nanoseconds), [&obj]() {return obj->count > 0;})) return ERR_TIMEOUT;
+	obj->count--;
+	return 0;
+}
+
+Result svcCloseHandle(Handle handle)
+{
+	return (removeObject(handle) ? 0 : ERR_INVALID_HANDLE);
+}
+
+Result svcGetThreadPriority(s32 *priority, Handle handle)
+{
+	*priority = 0x30;
+	return 0;
+}
+
+void svcSleepThread(s64 ns)
+{
+	std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+}
+
+u64 svcGetSystemTick(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * SYSCLOCK_ARM11 + (u64)ts.tv_nsec * SYSCLOCK_ARM11 / 1000000000;
+}
+
+
+
+//===============================================
+// Unicode                                     ||
+//===============================================
+
+// Like libctru these don't terminate the output
+ssize_t utf16_to_utf8(u8 *out, const u16 *in, size_t len)
+{
+	ssize_t units = 0;
+
+	for(; *in; in++)
+	{
+		u8 enc[3];
+		u32 c = *in, n;
+
+		if(c < 0x80) {enc[0] = c; n = 1;}
+		else if(c < 0x800) {enc[0] = 0xC0 | c>>6; enc[1] = 0x80 | (c & 0x3F); n = 2;}
+		else {enc[0] = 0xE0 | c>>12; enc[1] = 0x80 | (c>>6 & 0x3F); enc[2] = 0x80 | (c & 0x3F); n = 3;}
+
+		if(out && (size_t)units + n <= len) memcpy(out + units, enc, n);
+		units += n;
+	}
+
+	return units;
+}
+
+ssize_t utf8_to_utf16(u16 *out, const u8 *in, size_t len)
+{
+	std::vector<u16> tmp(strlen((const char*)in) + 1);
+	u32 units = hostToUtf16((const char*)in, &tmp[0], tmp.size());
+
+	if(out) memcpy(out, &tmp[0], std::min<size_t>(units, len) * 2);
+	return units;
+}
+
+} // extern "C"
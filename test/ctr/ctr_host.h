@@ -0,0 +1,90 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _CTR_HOST_H_
+#define _CTR_HOST_H_
+
+#include <string>
+#include <vector>
+#include <3ds.h>
+
+
+
+// Knobs and records of the libctru stand-in. The SD card is a host dir,
+// AM keeps the installed titles in memory and checks every CIA written
+// to it. Paths are matched ignoring A-Z case like on the FAT SD card.
+//
+// Every FS and AM call counts as one IPC round trip and sleeps for the
+// configured latency. Calls from different threads sleep side by side,
+// which is what the workers of the app rely on.
+namespace ctrHost
+{
+	// Time a call takes in microseconds: perCall + size * perMiB / 1 MiB
+	struct Latency
+	{
+		u32 perCall;
+		u32 perMiB;
+	};
+
+	struct Config
+	{
+		Latency read;    // FSFILE_Read
+		Latency write;   // FSFILE_Write to SD files
+		Latency amWrite; // FSFILE_Write to AM install handles
+		u32 openUs;      // FSUSER_OpenFile, FSUSER_OpenDirectory and closing them
+		u32 dirReadUs;   // FSDIR_Read
+		u32 metaUs;      // Creating, deleting and renaming. Per removed object for recursive deletes.
+		u32 finishUs;    // AM_FinishCiaInstall and AM_InstallFirm
+		bool new3ds;     // Answer of APT_CheckNew3DS
+		u32 threadLimit; // threadCreate fails if this many threads exist. 0 is no limit. _3DS backend only.
+	};
+
+	// One AM_StartCiaInstall to AM_FinishCiaInstall or one AM_InstallFirm
+	struct AmInstall
+	{
+		u64 titleID;
+		u16 version;
+		u64 bytes;
+		u64 startTick, finishTick;
+		bool firm;
+	};
+
+
+	// Makes hostDir the SD root. Resets the counters, the records, the
+	// installed titles and the config.
+	void setRoot(const std::string& hostDir);
+	const std::string& root();
+	std::string hostPath(const std::string& sdPath); // Case resolved like the FS does it
+
+	Config& config();
+	u64  ipcCount();
+	void resetIpcCount(); // Resets maxConcurrentCalls() too
+	u32  maxConcurrentCalls(); // Most calls sleeping in their latency at once
+
+	// Titles AM reports as installed on NAND
+	void addInstalledTitle(u64 titleID, u16 version);
+	std::vector<AM_TitleEntry> installedTitles();
+
+	std::vector<AmInstall> amInstalls(); // Finished installs and firm installs in finish order
+	u32  cancelledInstalls();
+	void clearAmRecords();
+}
+
+#endif // _CTR_HOST_H_
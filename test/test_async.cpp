@@ -0,0 +1,141 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// File::readAsync() and writeAsync(). Requests finish in order, close()
+// waits for them and errors come out of wait(). Hashing a file while the
+// next block is read should take about the longer of the two, not the sum.
+
+#include <cstring>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+#include "misc.h"
+#include "sha256.h"
+
+
+
+static const u32 fileSize = 0x800000; // 8 MB
+
+
+static double hashSync(u8 *hash)
+{
+	const u64 startTick = svcGetSystemTick();
+	fs::File file(u"/async.bin", FS_OPEN_READ);
+	Buffer<u8> buf(0x100000, false);
+	Sha256 sha;
+	u32 size;
+
+
+	while((size = file.read(&buf, buf.size()))) sha.update(&buf, size);
+	sha.finish(hash);
+
+	return ticksToMs(svcGetSystemTick() - startTick);
+}
+
+
+// Two buffers. The next block is read while the current one is hashed.
+static double hashAsync(u8 *hash)
+{
+	const u64 startTick = svcGetSystemTick();
+	fs::File file(u"/async.bin", FS_OPEN_READ);
+	Buffer<u8> buf0(0x100000, false), buf1(0x100000, false);
+	u8 *bufs[2] = {&buf0, &buf1};
+	fs::IoHandle req = file.readAsync(bufs[0], 0x100000, 0);
+	u64 offset = 0;
+	u32 cur = 0, size;
+	Sha256 sha;
+
+
+	while(req && (size = req->wait()))
+	{
+		offset += size;
+		req.reset();
+		if(offset<fileSize) req = file.readAsync(bufs[cur ^ 1], 0x100000, offset);
+		sha.update(bufs[cur], size);
+		cur ^= 1;
+	}
+	sha.finish(hash);
+
+	return ticksToMs(svcGetSystemTick() - startTick);
+}
+
+
+int main()
+{
+	TestSd sd;
+	const std::vector<u8> data = testData(fileSize, 7);
+	std::vector<u8> readBack(fileSize);
+
+
+	try
+	{
+		// Nobody waits for the writes. Closing the file has to.
+		{
+			fs::File file(u"/async.bin", FS_OPEN_WRITE|FS_OPEN_CREATE);
+
+			file.setSize(0);
+			file.setWriteMode(FS_FLUSH_ON_CLOSE);
+			for(u32 offset = 0; offset<fileSize; offset += 0x10000) file.writeAsync(&data[offset], 0x10000, offset);
+		}
+		CHECK(sd.readFile("/async.bin") == data);
+
+		{
+			fs::File file(u"/async.bin", FS_OPEN_READ);
+			std::vector<fs::IoHandle> reqs;
+			bool sizesOk = true;
+
+			CHECK(file.size() == fileSize);
+			for(u32 offset = 0; offset<fileSize; offset += 0x8000) reqs.push_back(file.readAsync(&readBack[offset], 0x8000, offset));
+			for(auto& it : reqs) sizesOk &= (it->wait() == 0x8000);
+			CHECK(sizesOk);
+			CHECK(reqs.back()->done());
+			CHECK(readBack == data);
+
+			// Past the end there is nothing to read
+			CHECK(file.readAsync(&readBack[0], 16, fileSize + 10)->wait() == 0);
+		}
+
+		// Writing through a read-only handle fails on the I/O thread
+		{
+			fs::File file(u"/async.bin", FS_OPEN_READ);
+			fs::IoHandle req = file.writeAsync(&data[0], 16, 0);
+			bool threw = false;
+
+			try {req->wait();}
+			catch(fsException& e) {threw = true;}
+			CHECK(threw);
+		}
+
+		// 20 ms per MiB read takes about as long as hashing on a slow host
+		u8 syncHash[32], asyncHash[32], expected[32];
+		Sha256 sha;
+
+		sha.update(data.data(), data.size());
+		sha.finish(expected);
+		ctrHost::config().read = {0, 20000};
+		const double syncMs = hashSync(syncHash);
+		const double asyncMs = hashAsync(asyncHash);
+		printf("hash 8 MiB: sync %.1f ms, async %.1f ms\n", syncMs, asyncMs);
+		CHECK(!memcmp(syncHash, expected, 32) && !memcmp(asyncHash, expected, 32));
+		CHECK(asyncMs < syncMs);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
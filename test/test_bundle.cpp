@@ -0,0 +1,63 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// CiaBundle only picks the CIAs out of updates.zip this build can install.
+// Without zstd a .cia.zst entry is skipped like any other file instead of
+// failing the whole bundle.
+
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "bundle.h"
+#include "common.h"
+#include "fs.h"
+#include "title.h"
+
+
+
+int main()
+{
+	TestSd sd;
+
+
+	sd.makeDir("/updates");
+	sd.writeFile("/updates/updates.zip", makeZip({
+		{"a.cia", makeCia(0x0004001B00010002LL, 0x400, {0x8000}, 1)},
+		{"B.CIA", makeCia(0x0004001B00010702LL, 0x400, {0x8000}, 2)},
+		{"c.cia.zst", testData(0x1000, 3)},
+		{"readme.txt", testData(0x100, 4)}}));
+
+	try
+	{
+		CiaBundle bundle(u"/updates/updates.zip");
+		std::vector<std::u16string> names;
+
+		for(auto& it : bundle.entries()) names.push_back(it.name);
+#ifdef WITH_ZSTD
+		CHECK(names.size() == 3);
+#else
+		CHECK((names == std::vector<std::u16string>{u"a.cia", u"B.CIA"}));
+#endif
+		CHECK(bundle.entries()[0].info.titleID == 0x0004001B00010002LL);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
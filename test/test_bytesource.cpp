@@ -0,0 +1,188 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Every ByteSource installs the same CIA through installCia(ByteSource&, ...).
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <3ds.h>
+#include "bytesource.h"
+#include "common.h"
+#include "compress.h"
+#include "error.h"
+#include "thread.h"
+#include "title.h"
+
+
+
+static bool installedOnce(u64 titleID, u64 bytes)
+{
+	std::vector<ctrHost::AmInstall> installs = ctrHost::amInstalls();
+
+	ctrHost::clearAmRecords();
+	return installs.size() == 1 && installs[0].titleID == titleID && installs[0].bytes == bytes;
+}
+
+
+// Sends the first size bytes of data in odd pieces on a thread and closes
+// its end of the socket pair. The other end goes to *receiver.
+static WorkerThread* startSender(const std::vector<u8>& data, u32 size, int *receiver)
+{
+	int fds[2];
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {perror("socketpair"); exit(2);}
+	*receiver = fds[0];
+	return new WorkerThread([&data, size, fds]()
+	{
+		for(u32 pos = 0; pos<size; pos += 0x7001)
+		{
+			if(send(fds[1], &data[pos], (size - pos<0x7001 ? size - pos : 0x7001), 0)<0) break;
+		}
+		close(fds[1]);
+	});
+}
+
+
+int main()
+{
+	TestSd sd;
+	const u64 titleID = 0x0004013000001502LL;
+	const std::vector<u8> cia = makeCia(titleID, 0x2C10, {0x200000, 0x1234, 0x30000});
+	std::vector<u8> compressed = lz4Frame(cia);
+	u32 lastPercent;
+
+
+	printf("CIA %u bytes, LZ4 %u bytes\n", (unsigned int)cia.size(), (unsigned int)compressed.size());
+	CHECK(compressed.size()<cia.size() / 4);
+	sd.makeDir("/updates");
+	sd.writeFile("/updates/title.cia", cia);
+	sd.writeFile("/updates/title.cia.lz4", compressed);
+
+	try
+	{
+		FileSource source(u"/updates/title.cia", TUNE_INSTALL_NAND);
+		lastPercent = 0;
+		InstallStats stats = installCia(source, MEDIATYPE_NAND, u"title.cia", [&](const std::u16string& file, u32 percent) {lastPercent = percent;});
+
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 3);
+		CHECK(source.position() == cia.size() && lastPercent == 100);
+		CHECK(installedOnce(titleID, cia.size()));
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	try
+	{
+		MemorySource source(cia.data(), cia.size());
+		InstallStats stats = installCia(source, MEDIATYPE_NAND, u"title.cia");
+
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 3);
+		CHECK(installedOnce(titleID, cia.size()));
+	}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	// Compressed from memory and from a file. The progress is the one of the compressed data.
+	try
+	{
+		std::unique_ptr<ByteSource> memory(new MemorySource(compressed.data(), compressed.size()));
+		std::unique_ptr<ByteSource> source = decompressIfNeeded(std::move(memory), u"title.cia.lz4");
+		InstallStats stats = installCia(*source, MEDIATYPE_NAND, u"title.cia.lz4");
+
+		CHECK(source->size() == compressed.size() && source->position() == compressed.size());
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 3);
+		CHECK(installedOnce(titleID, cia.size()));
+
+		std::unique_ptr<ByteSource> file(new FileSource(u"/updates/title.cia.lz4", TUNE_INSTALL_NAND));
+		source = decompressIfNeeded(std::move(file), u"title.cia.lz4");
+		lastPercent = 0;
+		stats = installCia(*source, MEDIATYPE_NAND, u"title.cia.lz4", [&](const std::u16string& file, u32 percent) {lastPercent = percent;});
+
+		CHECK(stats.bytes == cia.size() && lastPercent == 100);
+		CHECK(installedOnce(titleID, cia.size()));
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	// From a socket the CIA arrives in pieces of whatever size recv() returns
+	try
+	{
+		int receiver;
+		std::unique_ptr<WorkerThread> sender(startSender(cia, cia.size(), &receiver));
+		SocketSource source(receiver, cia.size());
+		InstallStats stats = installCia(source, MEDIATYPE_NAND, u"title.cia");
+
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 3);
+		CHECK(source.position() == cia.size());
+		CHECK(installedOnce(titleID, cia.size()));
+		sender.reset();
+		close(receiver);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	// A connection closed early must cancel the install
+	{
+		int receiver;
+		std::unique_ptr<WorkerThread> sender(startSender(cia, cia.size() / 2, &receiver));
+		bool threw = false;
+
+		try
+		{
+			SocketSource source(receiver, cia.size());
+			installCia(source, MEDIATYPE_NAND, u"title.cia");
+		}
+		catch(fsException& e) {threw = true;}
+		catch(titleException& e) {threw = true;}
+		CHECK(threw);
+		CHECK(ctrHost::amInstalls().empty() && ctrHost::cancelledInstalls() == 1);
+		ctrHost::clearAmRecords();
+		sender.reset();
+		close(receiver);
+	}
+
+	// Compressed suffixes are matched ignoring case like the listing filter does
+	sd.writeFile("/updates/FOO.CIA.LZ4", compressed);
+	CHECK(isCompressed(u"FOO.CIA.LZ4") && isCompressed(u"foo.Cia.Zst") && !isCompressed(u"FOO.CIA"));
+	try
+	{
+		InstallStats stats = installCia(u"/updates/FOO.CIA.LZ4", MEDIATYPE_NAND);
+
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 3);
+		CHECK(installedOnce(titleID, cia.size()));
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	// A truncated frame must cancel the install
+	try
+	{
+		DecompressSource source(std::unique_ptr<ByteSource>(new MemorySource(compressed.data(), compressed.size() - 4)),
+		                        std::unique_ptr<Decompressor>(createDecompressor(u"title.cia.lz4")));
+
+		installCia(source, MEDIATYPE_NAND, u"title.cia.lz4");
+		CHECK(!"truncated frame installed");
+	}
+	catch(titleException& e) {CHECK(e.getErrCode() == ERR_BAD_COMPRESSED);}
+	CHECK(ctrHost::amInstalls().empty() && ctrHost::cancelledInstalls() == 1);
+
+	return testsDone();
+}
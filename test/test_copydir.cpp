@@ -0,0 +1,126 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Incremental copyDir(). Every copied file goes into the hash index so the
+// next run doesn't have to hash the destination again. A copy index in the
+// source root only belongs to the source tree in incremental mode.
+
+#include <cstring>
+#include <functional>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+static u32 indexCount(TestSd& sd, const std::string& dir)
+{
+	const std::vector<u8> data = sd.readFile(dir + "/.sysUpdater.copyidx");
+	u32 count;
+
+	if(data.size()<8 || memcmp(&data[0], "CIDX", 4)) return 0;
+	memcpy(&count, &data[4], 4);
+	return count;
+}
+
+
+static u64 ipcOf(std::function<void ()> func)
+{
+	u64 before = ctrHost::ipcCount();
+
+	func();
+	return ctrHost::ipcCount() - before;
+}
+
+
+int main()
+{
+	TestSd sd;
+	const u64 totalSize = 3 * 0x1000 + 0x80000 + 0x300000;
+	fs::CopyStats stats;
+
+
+	sd.makeDir("/src/sub/deeper");
+	sd.writeFile("/src/a.bin", testData(0x1000, 1));
+	sd.writeFile("/src/sub/b.bin", testData(0x1000, 2));
+	sd.writeFile("/src/sub/deeper/c.bin", testData(0x1000, 3));
+	sd.writeFile("/src/big1.bin", testData(0x80000, 4));  // Bigger than COPY_SMALL_FILE_SIZE
+	sd.writeFile("/src/sub/big2.bin", testData(0x300000, 5));
+
+	try
+	{
+		// First run copies everything and indexes every file
+		stats = fs::copyDir(u"/src", u"/dst", nullptr, sdmcArchive, sdmcArchive, true);
+		CHECK(stats.copiedBytes == totalSize && stats.skippedBytes == 0);
+		CHECK(indexCount(sd, "/dst") == 5);
+		CHECK(sd.readFile("/dst/sub/big2.bin") == testData(0x300000, 5));
+
+		// Second run only hashes the source
+		u64 indexedIpc = ipcOf([&]() {stats = fs::copyDir(u"/src", u"/dst", nullptr, sdmcArchive, sdmcArchive, true);});
+		CHECK(stats.copiedBytes == 0 && stats.skippedBytes == totalSize);
+
+		remove(sd.hostPath("/dst/.sysUpdater.copyidx").c_str());
+		fs::clearDirCache();
+		u64 unindexedIpc = ipcOf([&]() {stats = fs::copyDir(u"/src", u"/dst", nullptr, sdmcArchive, sdmcArchive, true);});
+		CHECK(stats.copiedBytes == 0 && stats.skippedBytes == totalSize);
+		CHECK(indexCount(sd, "/dst") == 5);
+		printf("unchanged run: %llu IPC with index, %llu without\n", (unsigned long long)indexedIpc, (unsigned long long)unindexedIpc);
+		CHECK(indexedIpc < unindexedIpc);
+
+		// A changed file is copied and indexed again
+		sd.writeFile("/src/sub/b.bin", testData(0x2000, 6));
+		fs::clearDirCache();
+		stats = fs::copyDir(u"/src", u"/dst", nullptr, sdmcArchive, sdmcArchive, true);
+		CHECK(stats.copiedBytes == 0x2000 && stats.skippedBytes == totalSize - 0x1000);
+		CHECK(sd.readFile("/dst/sub/b.bin") == testData(0x2000, 6));
+		CHECK(indexCount(sd, "/dst") == 5);
+
+		// A plain copy of the destination takes the index along like any other file
+		fs::clearDirCache();
+		stats = fs::copyDir(u"/dst", u"/plain");
+		CHECK(sd.exists("/plain/.sysUpdater.copyidx"));
+		CHECK(sd.readFile("/plain/.sysUpdater.copyidx") == sd.readFile("/dst/.sysUpdater.copyidx"));
+
+		// An incremental copy of it doesn't and keeps its own index
+		fs::clearDirCache();
+		stats = fs::copyDir(u"/dst", u"/mirror", nullptr, sdmcArchive, sdmcArchive, true);
+		CHECK(indexCount(sd, "/mirror") == 5);
+		CHECK(stats.copiedBytes == totalSize - 0x1000 + 0x2000);
+
+		// Paths are joined without doubled slashes, also for the root
+		std::u16string path(u"/a/");
+		fs::addToPath(path, u"b");
+		CHECK(path == u"/a/b");
+		path = u"/";
+		fs::addToPath(path, u"b");
+		CHECK(path == u"/b");
+
+		sd.makeDir("/one");
+		sd.writeFile("/one/x.bin", testData(0x1000, 7));
+		fs::clearDirCache();
+		stats = fs::copyDir(u"/one", u"/", nullptr, sdmcArchive, sdmcArchive, true);
+		CHECK(stats.copiedBytes == 0x1000 && indexCount(sd, "") == 1);
+		CHECK(fs::fileExist(u"/.sysUpdater.copyidx"));
+		stats = fs::copyDir(u"/one", u"/", nullptr, sdmcArchive, sdmcArchive, true);
+		CHECK(stats.copiedBytes == 0 && stats.skippedBytes == 0x1000);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
@@ -0,0 +1,80 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// deleteTree() counts what it deleted and drops the tree from the dir
+// cache. deleteDir("/") empties the root through it.
+
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+static void makeTree(TestSd& sd, const std::string& dir, u32 seed)
+{
+	sd.makeDir(dir + "/a/b");
+	sd.makeDir(dir + "/c");
+	for(u32 i = 0; i < 4; i++)
+	{
+		sd.writeFile(dir + "/f" + std::to_string(i) + ".bin", testData(0x100, seed + i));
+		sd.writeFile(dir + "/a/b/g" + std::to_string(i) + ".bin", testData(0x100, seed + i));
+	}
+	sd.writeFile(dir + "/c/h.bin", testData(0x100, seed));
+}
+
+
+int main()
+{
+	TestSd sd;
+	fs::DeleteStats stats;
+
+
+	makeTree(sd, "/t1", 1);
+	makeTree(sd, "/t2", 2);
+	sd.writeFile("/root.bin", testData(0x100, 3));
+	ctrHost::config().metaUs = 200;
+
+	try
+	{
+		// Cached listings of the tree must not survive it
+		CHECK(fs::listDirContents(u"/t1/a/b").size() == 4);
+		stats = fs::deleteTree(u"/t1");
+		CHECK(stats.fileCount == 9 && stats.dirCount == 4);
+		CHECK(stats.objectsPerSec() > 0);
+		CHECK(!sd.exists("/t1"));
+		CHECK(!fs::dirExist(u"/t1") && !fs::dirExist(u"/t1/a/b"));
+		CHECK(sd.exists("/t2/a/b/g3.bin") && fs::dirExist(u"/t2/a/b"));
+
+		fs::deleteDir(u"/t2/a");
+		CHECK(!sd.exists("/t2/a") && !fs::dirExist(u"/t2/a"));
+		CHECK(sd.exists("/t2/c/h.bin"));
+
+		makeTree(sd, "/t3", 4);
+		fs::clearDirCache();
+		stats = fs::deleteDir(u"/");
+		CHECK(stats.fileCount == 9 + 5 + 1 && stats.dirCount == 4 + 2);
+		CHECK(fs::listDirContents(u"/").empty());
+		CHECK(!sd.exists("/t2") && !sd.exists("/t3") && !sd.exists("/root.bin"));
+		CHECK(sd.exists("/"));
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
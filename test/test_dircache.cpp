@@ -0,0 +1,144 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// The dir cache must always agree with the FS after the fs functions
+// changed it, and repeated lookups must not cost IPC. Every check compares
+// against a fresh listing or a host stat().
+
+#include <cstdio>
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+// 0 missing, 1 file, 2 dir. From the (cached) listing of dir.
+static int listed(const std::u16string& dir, const std::u16string& name)
+{
+	for(auto& it : fs::listDirContents(dir)) if(it.name == name) return (it.isDir ? 2 : 1);
+	return 0;
+}
+
+
+int main()
+{
+	TestSd sd;
+	u64 before, first;
+
+
+	sd.makeDir("/tree/a/b");
+	sd.makeDir("/tree/c");
+	sd.writeFile("/tree/1.bin", testData(0x100));
+	sd.writeFile("/tree/a/2.bin", testData(0x2000));
+	sd.writeFile("/tree/a/b/3.bin", testData(0x30000));
+	sd.writeFile("/tree/c/4.bin", {});
+
+	try
+	{
+		// Walking a tree twice only costs IPC once
+		before = ctrHost::ipcCount();
+		fs::DirInfo info = fs::getDirInfo(u"/tree");
+		first = ctrHost::ipcCount() - before;
+		before = ctrHost::ipcCount();
+		fs::DirInfo again = fs::getDirInfo(u"/tree");
+		CHECK(info.fileCount == 4 && info.dirCount == 3 && info.size == 0x100 + 0x2000 + 0x30000);
+		CHECK(again.fileCount == info.fileCount && again.size == info.size);
+		CHECK(first > 0 && ctrHost::ipcCount() == before);
+
+		before = ctrHost::ipcCount();
+		fs::makePath(u"/ct/x/y");
+		first = ctrHost::ipcCount() - before;
+		before = ctrHost::ipcCount();
+		fs::makePath(u"/ct/x/y");
+		CHECK(first > 0 && ctrHost::ipcCount() == before);
+		CHECK(fs::dirExist(u"/ct/x/y") && sd.exists("/ct/x/y"));
+		CHECK(listed(u"/ct/x", u"y") == 2 && !listed(u"/ct/x/y", u"f.bin"));
+
+		// Trailing slashes name the same dir
+		fs::makePath(u"/ct/s/t/");
+		CHECK(fs::dirExist(u"/ct/s/t/") && fs::dirExist(u"/ct/s/t") && fs::dirExist(u"/CT/S/"));
+		CHECK(listed(u"/ct/s", u"t") == 2 && listed(u"/ct/s/", u"t") == 2);
+		fs::makeDir(u"/ct/s/t/");
+		CHECK(!fs::dirExist(u"/ct/s/t/u/"));
+
+		// A written file shows up with its size
+		{
+			fs::File f(u"/ct/x/y/f.bin", FS_OPEN_WRITE|FS_OPEN_CREATE);
+			f.write("hello", 5);
+		}
+		CHECK(listed(u"/ct/x/y", u"f.bin") == 1);
+		CHECK(fs::listDirContents(u"/ct/x/y")[0].size == 5);
+		CHECK(fs::fileExist(u"/ct/x/y/f.bin") && fs::fileExist(u"/CT/x/Y/F.BIN"));
+		{
+			fs::File f(u"/ct/x/y/f.bin", FS_OPEN_WRITE);
+			f.setSize(9);
+		}
+		CHECK(fs::listDirContents(u"/ct/x/y")[0].size == 9);
+
+		fs::moveFile(u"/ct/x/y/f.bin", u"/ct/x/g.bin");
+		CHECK(!listed(u"/ct/x/y", u"f.bin") && listed(u"/ct/x", u"g.bin") == 1);
+		CHECK(!fs::fileExist(u"/ct/x/y/f.bin") && fs::fileExist(u"/ct/x/g.bin"));
+
+		fs::deleteFile(u"/ct/x/g.bin");
+		CHECK(!listed(u"/ct/x", u"g.bin") && !fs::fileExist(u"/ct/x/g.bin") && !sd.exists("/ct/x/g.bin"));
+
+		fs::listDirContents(u"/ct");
+		fs::moveDir(u"/ct/x", u"/ct/z");
+		CHECK(!fs::dirExist(u"/ct/x/y") && fs::dirExist(u"/ct/z/y"));
+		CHECK(listed(u"/ct", u"z") == 2 && !listed(u"/ct", u"x"));
+
+		fs::copyDir(u"/tree", u"/ct/z/t");
+		fs::DirInfo copied = fs::getDirInfo(u"/ct/z/t");
+		CHECK(copied.fileCount == info.fileCount && copied.dirCount == info.dirCount && copied.size == info.size);
+		CHECK(sd.readFile("/ct/z/t/a/b/3.bin") == testData(0x30000));
+
+		fs::deleteDir(u"/ct/z");
+		CHECK(!fs::dirExist(u"/ct/z/t") && !fs::dirExist(u"/ct/Z") && !sd.exists("/ct/z"));
+		CHECK(listed(u"/ct", u"s") == 2 && fs::listDirContents(u"/ct").size() == 1);
+		CHECK(fs::dirExist(u"/TREE"));
+
+		// Changes behind the back of fs are only seen after clearDirCache()
+		sd.writeFile("/ct/s/outside.bin", {});
+		CHECK(!listed(u"/ct/s", u"outside.bin"));
+		fs::clearDirCache();
+		CHECK(listed(u"/ct/s", u"outside.bin") == 1);
+
+		// New dirs and files count against DIR_CACHE_MAX_ENTRIES like listings.
+		// Once it's full the cache starts over and lookups cost IPC again.
+		fs::listDirContents(u"/");
+		fs::makeDir(u"/many");
+		for(u32 i = 0; i < DIR_CACHE_MAX_ENTRIES + 10; i++) fs::makeDir(u"/many/d" + toUtf16(std::to_string(i)));
+		before = ctrHost::ipcCount();
+		CHECK(fs::dirExist(u"/many/d0") && ctrHost::ipcCount() > before);
+
+		fs::clearDirCache();
+		fs::makeDir(u"/files");
+		fs::listDirContents(u"/files");
+		for(u32 i = 0; i < DIR_CACHE_MAX_ENTRIES + 10; i++)
+		{
+			fs::File f(u"/files/f" + toUtf16(std::to_string(i)), FS_OPEN_WRITE|FS_OPEN_CREATE);
+		}
+		before = ctrHost::ipcCount();
+		CHECK(fs::fileExist(u"/files/f0") && ctrHost::ipcCount() > before);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}
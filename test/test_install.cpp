@@ -0,0 +1,83 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// installCia() from a CIA file: what AM gets, progress and broken CIAs.
+
+#include <cstdio>
+#include <3ds.h>
+#include "common.h"
+#include "error.h"
+#include "title.h"
+
+
+
+int main()
+{
+	TestSd sd;
+	std::vector<u8> cia = makeCia(0x0004013000001502LL, 0x2C10, {0x300000, 0x1234, 0});
+	u32 lastPercent = 0, calls = 0;
+	bool backwards = false;
+
+
+	sd.makeDir("/updates");
+	sd.writeFile("/updates/good.cia", cia);
+	cia[cia.size() - 0x1000] ^= 0xFF; // In the second content
+	sd.writeFile("/updates/bad.cia", cia);
+
+	// Read and write latency so the reader thread really runs ahead
+	ctrHost::config().read = {100, 2000};
+	ctrHost::config().amWrite = {100, 4000};
+
+	try
+	{
+		InstallStats stats = installCia(u"/updates/good.cia", MEDIATYPE_NAND, [&](const std::u16string& file, u32 percent)
+		{
+			if(percent < lastPercent) backwards = true;
+			lastPercent = percent;
+			calls++;
+		});
+
+		CHECK(stats.bytes == cia.size());
+		CHECK(stats.readTicks > 0 && stats.writeTicks > 0);
+		CHECK(stats.verifiedContents == 3 && stats.skippedContents == 0); // The empty last one too
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	CHECK(calls > 0 && lastPercent == 100 && !backwards);
+
+	std::vector<ctrHost::AmInstall> installs = ctrHost::amInstalls();
+	CHECK(installs.size() == 1);
+	CHECK(installs.size() == 1 && installs[0].titleID == 0x0004013000001502LL && installs[0].version == 0x2C10);
+	CHECK(installs.size() == 1 && installs[0].bytes == cia.size());
+
+	AM_TitleEntry entry = getCiaFileInfo(u"/updates/good.cia", MEDIATYPE_NAND);
+	CHECK(entry.titleID == 0x0004013000001502LL && entry.version == 0x2C10);
+
+	// The hash mismatch stops the install before AM finishes it
+	bool thrown = false;
+	try {installCia(u"/updates/bad.cia", MEDIATYPE_NAND);}
+	catch(titleException& e) {thrown = (e.getErrCode() == ERR_HASH_MISMATCH);}
+	CHECK(thrown);
+	CHECK(ctrHost::amInstalls().size() == 1);
+	CHECK(ctrHost::cancelledInstalls() == 1);
+
+	return testsDone();
+}
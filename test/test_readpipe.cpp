@@ -0,0 +1,104 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// ReadPipe hands out the file in order with and without a reader thread.
+// Only the _3DS thread backend can be made to fail creating threads.
+
+#include <cstring>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+#include "thread.h"
+#include "title.h"
+
+
+
+static bool readAll(const std::u16string& path, const std::vector<u8>& expected, u32 blockSize)
+{
+	fs::File file(path, FS_OPEN_READ);
+	std::vector<u8> data, hooked;
+	u8 *block;
+	u32 size;
+
+
+	{
+		fs::ReadPipe pipe(file, blockSize, 3);
+		while((size = pipe.next(&block))) data.insert(data.end(), block, block + size);
+	}
+
+	fs::BlockSizeTuner tuner(TUNE_COPY_SDMC, expected.size(), 3, false);
+	file.seek(0, FS_SEEK_SET);
+	fs::ReadPipe pipe(file, tuner, [&](const u8 *block, u32 size) {hooked.insert(hooked.end(), block, block + size);});
+	while(pipe.next(&block));
+
+	return data == expected && hooked == expected;
+}
+
+
+int main()
+{
+	TestSd sd;
+	const std::vector<u8> data = testData(0x345678, 7);
+	const std::vector<u8> cia = makeCia(0x0004013000001502LL, 0x2C10, {0x200000, 0x1234});
+
+
+	sd.makeDir("/updates");
+	sd.writeFile("/data.bin", data);
+	sd.writeFile("/updates/title.cia", cia);
+
+	try {CHECK(readAll(u"/data.bin", data, 0x40000));}
+	catch(fsException& e) {CHECK(!e.what());}
+
+#ifdef _3DS
+	// Hold the only thread there may be so every later threadCreate() fails
+	Semaphore hold(0, 1);
+	WorkerThread holder([&]() {hold.acquire();});
+	CHECK(holder.started());
+	ctrHost::config().threadLimit = 1;
+	CHECK(!WorkerThread([]() {}).started());
+
+	try
+	{
+		CHECK(readAll(u"/data.bin", data, 0x40000));
+
+		// Stopped early
+		fs::File file(u"/data.bin", FS_OPEN_READ);
+		fs::ReadPipe pipe(file, 0x40000, 3);
+		u8 *block;
+		CHECK(pipe.next(&block) == 0x40000 && !memcmp(block, data.data(), 0x40000));
+		pipe.abort();
+		CHECK(pipe.next(&block) == 0);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	try
+	{
+		InstallStats stats = installCia(u"/updates/title.cia", MEDIATYPE_NAND);
+		CHECK(stats.bytes == cia.size() && stats.verifiedContents == 2);
+		CHECK(ctrHost::amInstalls().size() == 1);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	ctrHost::config().threadLimit = 0;
+	hold.release();
+#endif
+
+	return testsDone();
+}
@@ -0,0 +1,70 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// The install report is valid CSV for any file name and counts the scan
+// before the first install into the run time.
+
+#include <cstdlib>
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "report.h"
+
+
+
+int main()
+{
+	TestSd sd;
+	InstallStats stats = {0x100000, 0, 0, 0, 0, 2, 1};
+	AM_TitleEntry entry = {0x0004013000001502LL, 0x100000, 0x2C10, {}};
+
+
+	sd.makeDir("/updates");
+	{
+		InstallReport report;
+
+		svcSleepThread(20000000); // The scan
+		report.add(u"say \"cheese\".cia", entry, stats, 0, SYSCLOCK_ARM11 / 100);
+		report.add(u"plain.cia", entry, stats, 0, SYSCLOCK_ARM11 / 100);
+		report.save(true);
+		CHECK(report.verifiedContents() == 4 && report.skippedContents() == 2);
+	}
+
+	const std::vector<u8> data = sd.readFile("/updates/installReport.csv");
+	const std::string csv(data.begin(), data.end());
+	std::vector<std::string> lines;
+
+	for(size_t pos = 0, end; (end = csv.find('\n', pos)) != std::string::npos; pos = end + 1) lines.push_back(csv.substr(pos, end - pos));
+
+	CHECK(lines.size() == 4);
+	if(lines.size() == 4)
+	{
+		CHECK(lines[1].find("\"say \"\"cheese\"\".cia\",0004013000001502,11280,1048576,") == 0);
+		CHECK(lines[2].find("\"plain.cia\",") == 0);
+		CHECK(lines[3].find("\"run (2 titles)\",,,2097152,") == 0);
+		CHECK(lines[3].substr(lines[3].length() - 4) == ",4,2");
+
+		// totalMs of the run is the 10th field
+		size_t pos = 0;
+		for(int i = 0; i < 9; i++) pos = lines[3].find(',', pos) + 1;
+		CHECK(atof(lines[3].c_str() + pos) >= 20.0);
+	}
+
+	return testsDone();
+}
@@ -0,0 +1,110 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// fs::BlockSizeTuner: buffer sizes with and without probing and tuners
+// of different transfer kinds probing and saving side by side.
+
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+#include "thread.h"
+
+#define BIG_TRANSFER (0x10000000ULL) // 256 MB
+
+
+
+// Runs a transfer until the tuner stops probing
+static void probe(fs::BlockSizeTuner& tuner)
+{
+	for(u32 i = 0; i < 64; i++) tuner.record(tuner.sizeFor(i));
+}
+
+
+static bool isPowerOf2(u32 x) {return x && !(x & (x - 1));}
+
+
+int main()
+{
+	TestSd sd;
+
+
+	// Probing needs the biggest candidate. Without probing the default is enough.
+	{
+		fs::BlockSizeTuner probing(TUNE_COPY_SDMC, BIG_TRANSFER, PIPE_BLOCKS);
+		fs::BlockSizeTuner plain(TUNE_COPY_SDMC, BIG_TRANSFER, PIPE_BLOCKS, false);
+
+		CHECK(probing.maxBlockSize() == TUNE_MAX_BLOCK);
+		CHECK((u64)probing.maxBlockSize() * PIPE_BLOCKS <= TUNE_MEM_CAP);
+		CHECK(plain.maxBlockSize() == MAX_BUF_SIZE);
+		CHECK(plain.sizeFor(0) == MAX_BUF_SIZE && plain.sizeFor(100) == MAX_BUF_SIZE);
+	}
+
+	// Small transfers get small buffers
+	{
+		fs::BlockSizeTuner small(TUNE_COPY_SDMC, 100000, PIPE_BLOCKS);
+		CHECK(small.maxBlockSize() == TUNE_MIN_BLOCK);
+		CHECK(small.sizeFor(0) <= small.maxBlockSize());
+	}
+
+	// Once tuned the buffers are only as big as the tuned size
+	{
+		fs::BlockSizeTuner tuner(TUNE_INSTALL_NAND, BIG_TRANSFER, PIPE_BLOCKS);
+		probe(tuner);
+		u32 tuned = tuner.sizeFor(1000);
+		CHECK(isPowerOf2(tuned) && tuned >= TUNE_MIN_BLOCK && tuned <= TUNE_MAX_BLOCK);
+
+		fs::BlockSizeTuner next(TUNE_INSTALL_NAND, BIG_TRANSFER, PIPE_BLOCKS);
+		CHECK(next.maxBlockSize() == tuned);
+		CHECK(next.sizeFor(0) == tuned);
+	}
+
+	// Every kind probes on its own thread at once. All of them must end up in the file.
+	{
+		std::vector<std::unique_ptr<WorkerThread>> workers;
+		for(u32 key = 0; key < TUNE_KEY_COUNT; key++)
+		{
+			workers.emplace_back(new WorkerThread([key]()
+			{
+				for(u32 run = 0; run < 20; run++)
+				{
+					fs::BlockSizeTuner tuner((tuneKey)key, BIG_TRANSFER);
+					probe(tuner);
+				}
+			}));
+			CHECK(workers.back()->started());
+		}
+		workers.clear();
+
+		std::vector<u8> file = sd.readFile(toUtf8(TUNE_FILE_PATH));
+		u32 sizes[2][TUNE_KEY_COUNT + 1];
+		CHECK(file.size() == sizeof(sizes));
+		if(file.size() == sizeof(sizes))
+		{
+			memcpy(sizes, file.data(), sizeof(sizes));
+			CHECK(sizes[0][0] == TUNE_KEY_COUNT);
+			for(u32 key = 0; key < TUNE_KEY_COUNT; key++) CHECK(isPowerOf2(sizes[0][key + 1]));
+		}
+	}
+
+	return testsDone();
+}
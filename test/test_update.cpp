@@ -0,0 +1,158 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// installUpdates() against the AM stand-in. Firmware, modules, applets and
+// system apps must be installed strictly one after another in priority
+// order. Only the system data archives at the end may overlap each other.
+
+#include <algorithm>
+#include <cstdio>
+#include <3ds.h>
+#include "common.h"
+#include "error.h"
+#include "fs.h"
+#include "title.h"
+#include "update.h"
+
+
+
+static bool isData(u64 titleID)
+{
+	const u32 type = titleID>>32;
+	return type == 0x0004001B || type == 0x0004009B || type == 0x000400DB;
+}
+
+
+static u32 priority(u64 titleID)
+{
+	static const u32 types[] = {0x00040138, 0x00040130, 0x00040030, 0x00040010};
+
+	for(u32 i = 0; i < 4; i++) if((u32)(titleID>>32) == types[i]) return i;
+	return 4;
+}
+
+
+int main()
+{
+	TestSd sd;
+	ctrHost::Config& config = ctrHost::config();
+	const u64 titles[] = {
+		0x0004013800000002LL, // NATIVE_FIRM
+		0x0004013000001502LL, 0x0004013000001702LL, // Modules
+		0x0004003000008202LL, // Home menu
+		0x0004001000021A00LL, // System app
+		0x0004001B00010002LL, 0x0004001B00010702LL, 0x0004009B00010402LL, 0x000400DB00010302LL, 0x0004001B00018002LL, 0x0004009B00014002LL};
+	const u32 count = sizeof(titles) / sizeof(titles[0]);
+	char name[32];
+
+
+	sd.makeDir("/updates");
+	for(u32 i = 0; i < count; i++)
+	{
+		// Bigger than BATCH_MAX_CIA_SIZE so every title is streamed from the SD card
+		snprintf(name, sizeof(name), "/updates/%016llX.cia", (unsigned long long)titles[i]);
+		sd.writeFile(name, makeCia(titles[i], 0x400, {0x180000, 0x1000}, i));
+		ctrHost::addInstalledTitle(titles[i], 0x100);
+	}
+	config.read    = {200, 10000};
+	config.amWrite = {200, 50000};
+	config.finishUs = 20000;
+
+	try {installUpdates(false);}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+
+	std::vector<ctrHost::AmInstall> installs = ctrHost::amInstalls();
+	u32 firmInstalls = 0, ciaInstalls = 0;
+
+	for(auto& it : installs)
+	{
+		if(it.firm) {firmInstalls++; CHECK(it.titleID == 0x0004013800000002LL);}
+		else ciaInstalls++;
+	}
+	CHECK(firmInstalls == 1);
+	CHECK(ciaInstalls == count);
+	CHECK(ctrHost::cancelledInstalls() == 0);
+
+	// Nothing may overlap anything but data archives overlapping each other
+	bool overlapped = false;
+	for(u32 i = 0; i < installs.size(); i++)
+	{
+		for(u32 j = i + 1; j < installs.size(); j++)
+		{
+			const ctrHost::AmInstall &a = installs[i], &b = installs[j];
+			const bool overlap = a.startTick < b.finishTick && b.startTick < a.finishTick;
+
+			if(overlap && !(isData(a.titleID) && !a.firm && isData(b.titleID) && !b.firm))
+			{
+				printf("%016llX overlaps %016llX\n", (unsigned long long)a.titleID, (unsigned long long)b.titleID);
+				overlapped = true;
+			}
+		}
+	}
+	CHECK(!overlapped);
+
+	// Start order follows the priority. The firm install comes right after the NATIVE_FIRM CIA.
+	std::sort(installs.begin(), installs.end(), [](const ctrHost::AmInstall& a, const ctrHost::AmInstall& b) {return a.startTick < b.startTick;});
+	bool ordered = installs.size() == count + 1 && installs[1].firm && installs[0].titleID == installs[1].titleID;
+	for(u32 i = 1; i < installs.size(); i++) ordered &= priority(installs[i - 1].titleID) <= priority(installs[i].titleID);
+	CHECK(ordered);
+
+	// The data archives against how long they would have taken one after another
+	u64 serialTicks = 0, first = U64_MAX, last = 0;
+	u32 maxParallel = 0;
+	for(auto& it : installs)
+	{
+		if(!isData(it.titleID)) continue;
+
+		serialTicks += it.finishTick - it.startTick;
+		first = std::min(first, it.startTick);
+		last = std::max(last, it.finishTick);
+
+		u32 parallel = 0;
+		for(auto& other : installs) parallel += (isData(other.titleID) && other.startTick <= it.startTick && it.startTick < other.finishTick);
+		maxParallel = std::max(maxParallel, parallel);
+	}
+	printf("data archives: serial %.1f ms, concurrent %.1f ms, speedup %.2fx, up to %u at once\n",
+	       ticksToMs(serialTicks), ticksToMs(last - first), (double)serialTicks / (last - first), maxParallel);
+	CHECK(maxParallel > 1 && maxParallel <= 3);
+	CHECK(last - first < serialTicks * 3 / 4);
+
+	// Everything is up to date now
+	ctrHost::clearAmRecords();
+	try {installUpdates(false);}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {CHECK(!e.what());}
+	CHECK(ctrHost::amInstalls().empty());
+
+	// An error of a concurrent install comes out with its own result
+	std::vector<u8> corrupt = makeCia(titles[5], 0x500, {0x180000, 0x1000}, 5);
+	corrupt.back() ^= 0xFF;
+	sd.writeFile("/updates/0004001B00010002.cia", corrupt);
+	sd.writeFile("/updates/0004001B00010702.cia", makeCia(titles[6], 0x500, {0x180000, 0x1000}, 6));
+	fs::clearDirCache();
+	s32 errCode = 0;
+	try {installUpdates(false);}
+	catch(fsException& e) {CHECK(!e.what());}
+	catch(titleException& e) {errCode = e.getErrCode();}
+	CHECK(errCode == ERR_HASH_MISMATCH);
+	CHECK(ctrHost::cancelledInstalls() == 1);
+
+	return testsDone();
+}
@@ -0,0 +1,92 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Only the SD card gets worker threads. Other archives may not like
+// concurrent requests, so copying, counting and deleting there must never
+// have more than one FS call in flight. The stand-in maps every archive
+// to the same dir, so the results can be compared.
+
+#include <string>
+#include <3ds.h>
+#include "common.h"
+#include "fs.h"
+
+
+
+#define FILE_COUNT  (24)
+
+
+
+static std::u16string fileName(const char *dir, u32 i)
+{
+	return toUtf16(std::string(dir) + "/f" + std::to_string(i) + ".bin");
+}
+
+
+int main()
+{
+	TestSd sd;
+	ctrHost::Config& config = ctrHost::config();
+	FS_Archive other;
+
+
+	FSUSER_OpenArchive(&other, ARCHIVE_SAVEDATA_AND_CONTENT, fsMakePath(PATH_EMPTY, ""));
+	sd.makeDir("/src/a/b");
+	sd.makeDir("/src/c");
+	for(u32 i = 0; i < FILE_COUNT; i++) sd.writeFile(toUtf8(fileName("/src", i)), testData(0x1000, i));
+	config.openUs = 300;
+	config.metaUs = 300;
+	config.dirReadUs = 300;
+
+	try
+	{
+		// The SD card for reference
+		sd.makeDir("/sd");
+		ctrHost::resetIpcCount();
+		{
+			fs::SmallFileCopier copier;
+			for(u32 i = 0; i < FILE_COUNT; i++) copier.add(fileName("/src", i), fileName("/sd", i));
+			CHECK(copier.wait() == FILE_COUNT);
+		}
+		CHECK(ctrHost::maxConcurrentCalls() > 1);
+
+		sd.makeDir("/other");
+		ctrHost::resetIpcCount();
+		{
+			fs::SmallFileCopier copier(sdmcArchive, other);
+			for(u32 i = 0; i < FILE_COUNT; i++) copier.add(fileName("/src", i), fileName("/other", i));
+			CHECK(copier.wait() == FILE_COUNT);
+		}
+		CHECK(ctrHost::maxConcurrentCalls() == 1);
+		CHECK(sd.readFile(toUtf8(fileName("/other", FILE_COUNT - 1))) == testData(0x1000, FILE_COUNT - 1));
+
+		ctrHost::resetIpcCount();
+		fs::DirInfo info = fs::getDirInfo(u"/", other);
+		CHECK(info.fileCount == 3 * FILE_COUNT && info.dirCount == 6);
+		CHECK(ctrHost::maxConcurrentCalls() == 1);
+
+		ctrHost::resetIpcCount();
+		fs::DeleteStats stats = fs::deleteTree(u"/other", other);
+		CHECK(stats.fileCount == FILE_COUNT && !sd.exists("/other"));
+		CHECK(ctrHost::maxConcurrentCalls() == 1);
+	}
+	catch(fsException& e) {CHECK(!e.what());}
+
+	return testsDone();
+}